@@ -0,0 +1,85 @@
+/*
+ Kick onsets from an audio input, for kits without a piezo: a contact mic or the kick mic split off the PA.
+ The input goes through a DC blocker and a low pass biquad (the kick's low band, cymbals and vocals bleeding
+ into the mic mostly fall above it), and the energy of the filtered signal is taken over each analog frame's
+ worth of audio samples (2 at -p 16 with 8 analog channels). The level is the RMS of that times a gain, held
+ by an envelope with an instant attack and an exponential release, so it looks like the piezo to render.cpp:
+ the onset and release thresholds, the retrigger timeout and the classifier (OnsetClassifier.h) all work on
+ it unchanged, at the analog rate, and onsets are still timed to the analog frame.
+ Every audio sample costs the same handful of multiplies and adds whatever the signal does, so the cost per
+ block is fixed; it shows up in the "audioInput" stage histogram and Tools/AudioInputBench measures it.
+*/
+#ifndef AUDIO_ONSET_DETECTOR_H
+#define AUDIO_ONSET_DETECTOR_H
+
+#include <math.h>
+
+#define AUDIO_DC_CUTOFF 20.f // Hz
+
+struct AudioOnsetParams
+{
+	float dcPole; // DC blocker.
+	float b0, b1, b2, a1, a2; // low pass biquad, normalised so a0 = 1.
+	float gain;
+	float release; // envelope kept per analog frame.
+};
+
+struct AudioOnsetDetector
+{
+	float dcIn; // last input and output of the DC blocker.
+	float dcOut;
+	float x1, x2, y1, y2; // biquad state.
+	float energy; // summed squares since the last frame.
+	int count;
+	float envelope;
+};
+
+// Coefficients for a cutoff (Hz) and release (ms) at the given audio rate, with audioFramesPerFrame audio
+// samples to each analog frame. The detector's state is left alone, so this can be called while it runs.
+static inline void setAudioOnsetParams(AudioOnsetParams& p, float sampleRate, int audioFramesPerFrame, float cutoff, float gain, float release)
+{
+	p.dcPole = 1.f - 2.f * (float)M_PI * AUDIO_DC_CUTOFF / sampleRate;
+	// RBJ cookbook low pass, Q = 1/sqrt(2).
+	float w = 2.f * (float)M_PI * cutoff / sampleRate;
+	float alpha = sinf(w) / sqrtf(2.f);
+	float a0 = 1.f + alpha;
+	p.b0 = (1.f - cosf(w)) / 2.f / a0;
+	p.b1 = (1.f - cosf(w)) / a0;
+	p.b2 = p.b0;
+	p.a1 = -2.f * cosf(w) / a0;
+	p.a2 = (1.f - alpha) / a0;
+	p.gain = gain;
+	float frameRate = sampleRate / audioFramesPerFrame;
+	p.release = release > 0 ? expf(-1000.f / (release * frameRate)) : 0.f;
+}
+
+// One audio sample in.
+static inline void feedAudioOnset(AudioOnsetDetector& d, const AudioOnsetParams& p, float x)
+{
+	float dc = x - d.dcIn + p.dcPole * d.dcOut;
+	d.dcIn = x;
+	d.dcOut = dc;
+	float y = p.b0 * dc + p.b1 * d.x1 + p.b2 * d.x2 - p.a1 * d.y1 - p.a2 * d.y2;
+	d.x2 = d.x1;
+	d.x1 = dc;
+	d.y2 = d.y1;
+	d.y1 = y;
+	d.energy += y * y;
+	d.count++;
+}
+
+// The level for the analog frame, from the samples fed since the last call.
+static inline float audioOnsetLevel(AudioOnsetDetector& d, const AudioOnsetParams& p)
+{
+	float level = d.count ? p.gain * sqrtf(d.energy / d.count) : 0.f;
+	d.energy = 0;
+	d.count = 0;
+	d.envelope *= p.release;
+	if(level > d.envelope)
+	{
+		d.envelope = level;
+	}
+	return d.envelope;
+}
+
+#endif /* AUDIO_ONSET_DETECTOR_H */
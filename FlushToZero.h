@@ -0,0 +1,42 @@
+/*
+ Flush-to-zero for the render thread.
+ A float that underflows into the denormal range (below about 1e-38) is handled in software by the VFP on the
+ Cortex-A8, a hundred or more times slower than a normal operation, and the tracker makes them: the tails of
+ gaussianTempo(), envelopes and filters decaying in silence. With the FZ bit of the FPSCR set, denormal results
+ and inputs are taken as zero instead (NEON always works this way). x86 has the same through FTZ and DAZ in the
+ MXCSR, so the host replay runs the same arithmetic as the Bela.
+ The floating point control register belongs to the thread, so this has to be called from the render thread
+ itself, not from setup().
+*/
+#ifndef FLUSH_TO_ZERO_H
+#define FLUSH_TO_ZERO_H
+
+#if defined(__arm__) && !defined(__SOFTFP__)
+static inline void enableFlushToZero()
+{
+	unsigned int fpscr;
+	asm volatile("vmrs %0, fpscr" : "=r"(fpscr));
+	fpscr |= 1u << 24; // FZ
+	asm volatile("vmsr fpscr, %0" : : "r"(fpscr));
+}
+#elif defined(__aarch64__)
+static inline void enableFlushToZero()
+{
+	unsigned long fpcr;
+	asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+	fpcr |= 1ul << 24; // FZ
+	asm volatile("msr fpcr, %0" : : "r"(fpcr));
+}
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+static inline void enableFlushToZero()
+{
+	_mm_setcsr(_mm_getcsr() | 0x8040); // FTZ and DAZ
+}
+#else
+static inline void enableFlushToZero()
+{
+}
+#endif
+
+#endif /* FLUSH_TO_ZERO_H */
@@ -0,0 +1,155 @@
+/*
+ Session journal: a binary log of what went into the tracker and what came out of it, for working out after a
+ gig what went wrong (Tools/Journal dumps a journal and replays it through render.cpp).
+ Every record is a 64-bit audio sample time, a type and a payload size (12 bytes, little endian) and then the
+ payload, see JournalType for what each carries. The file starts with a JOURNAL_HEADER record.
+ The render thread puts records in a single producer, single consumer byte ring and never waits: if the ring is
+ full the record is dropped, and the next one that fits is preceded by a JOURNAL_DROPPED record with how many
+ were lost. A non-RT thread drains the ring to the file (drainJournal()) and flushes it, so a crash loses at
+ most what was written since the last drain.
+*/
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+#define JOURNAL_MAGIC 0x4E524A50 // "PJRN"
+#define JOURNAL_VERSION 1
+#define JOURNAL_RING (1 << 18) // bytes, a power of two. Several seconds of a busy set.
+#define JOURNAL_RECORD_HEADER 12
+
+enum JournalType
+{
+	JOURNAL_HEADER = 0, // u32 magic, u32 version, f32 audio rate, u32 audio frames, u32 analog frames per block.
+	JOURNAL_PARAMS = 1, // the parameter set taken at this block (render.cpp's TrackerParams, as bytes).
+	JOURNAL_RESTORED = 2, // u32 snapshot version, u8 resumed, then the snapshot restored in setup (TrackerState).
+	JOURNAL_SWITCH = 3, // u8 footswitch level read in this block.
+	JOURNAL_MODE = 4, // u8 mode entered.
+	JOURNAL_ONSET = 5, // at the crossing: u32 label, then the f32 samples of the classifier window.
+	JOURNAL_RELEASE = 6, // the onset detector was released on this (analog) frame, no payload.
+	JOURNAL_TEMPO = 7, // tracker decision for an onset, a JournalTempo.
+	JOURNAL_RESET = 8, // too long since the last onset, tracking started again.
+	JOURNAL_MIDI = 9, // the bytes written.
+	JOURNAL_DROPPED = 10 // u32 records lost to a full ring before this one.
+};
+
+static const char* const journalTypeNames[] = {"header", "params", "restored", "switch", "mode", "onset", "release",
+	"tempo", "reset", "midi", "dropped"};
+
+struct JournalTempo
+{
+	uint8_t mode;
+	float bpm;
+	float tempoThreshold;
+	float accuracy;
+	float syncDelta;
+	int32_t beatPos;
+} __attribute__((packed));
+
+struct JournalRing
+{
+	unsigned char bytes[JOURNAL_RING];
+	std::atomic<uint32_t> head; // written up to (render thread).
+	std::atomic<uint32_t> tail; // read up to (writer).
+	uint32_t dropped; // render thread.
+};
+
+static inline void journalCopyIn(JournalRing& r, uint32_t at, const void* data, uint32_t size)
+{
+	if(size == 0)
+	{
+		return;
+	}
+	uint32_t offset = at & (JOURNAL_RING - 1);
+	uint32_t first = size < JOURNAL_RING - offset ? size : JOURNAL_RING - offset;
+	memcpy(r.bytes + offset, data, first);
+	memcpy(r.bytes, (const unsigned char*)data + first, size - first);
+}
+
+static inline bool journalPut(JournalRing& r, uint64_t sample, int type, const void* payload, uint32_t size)
+{
+	uint32_t head = r.head.load(std::memory_order_relaxed);
+	uint32_t free = JOURNAL_RING - (head - r.tail.load(std::memory_order_acquire));
+	if(JOURNAL_RECORD_HEADER + size > free || size > 0xFFFF)
+	{
+		return false;
+	}
+	unsigned char header[JOURNAL_RECORD_HEADER];
+	for(int i = 0; i < 8; i++)
+	{
+		header[i] = sample >> (8 * i);
+	}
+	header[8] = type;
+	header[9] = type >> 8;
+	header[10] = size;
+	header[11] = size >> 8;
+	journalCopyIn(r, head, header, JOURNAL_RECORD_HEADER);
+	journalCopyIn(r, head + JOURNAL_RECORD_HEADER, payload, size);
+	r.head.store(head + JOURNAL_RECORD_HEADER + size, std::memory_order_release);
+	return true;
+}
+
+// Adds a record (render thread), or counts it as dropped if the ring is full.
+static inline void journalRecord(JournalRing& r, uint64_t sample, int type, const void* payload = 0, uint32_t size = 0)
+{
+	if(r.dropped > 0)
+	{
+		if(!journalPut(r, sample, JOURNAL_DROPPED, &r.dropped, 4))
+		{
+			r.dropped++;
+			return;
+		}
+		r.dropped = 0;
+	}
+	if(!journalPut(r, sample, type, payload, size))
+	{
+		r.dropped++;
+	}
+}
+
+// Writes everything in the ring to the file (the one non-RT thread that does).
+static inline void drainJournal(JournalRing& r, FILE* file)
+{
+	uint32_t tail = r.tail.load(std::memory_order_relaxed);
+	uint32_t head = r.head.load(std::memory_order_acquire);
+	while(tail != head)
+	{
+		uint32_t offset = tail & (JOURNAL_RING - 1);
+		uint32_t size = head - tail < JOURNAL_RING - offset ? head - tail : JOURNAL_RING - offset;
+		fwrite(r.bytes + offset, 1, size, file);
+		tail += size;
+	}
+	r.tail.store(tail, std::memory_order_release);
+	fflush(file);
+}
+
+// A record read back from a journal file (Tools/Journal).
+struct JournalEntry
+{
+	uint64_t sample;
+	int type;
+	std::vector<unsigned char> payload;
+};
+
+static inline bool readJournalEntry(FILE* file, JournalEntry& e)
+{
+	unsigned char header[JOURNAL_RECORD_HEADER];
+	if(fread(header, 1, JOURNAL_RECORD_HEADER, file) != JOURNAL_RECORD_HEADER)
+	{
+		return false;
+	}
+	e.sample = 0;
+	for(int i = 0; i < 8; i++)
+	{
+		e.sample |= (uint64_t)header[i] << (8 * i);
+	}
+	e.type = header[8] | header[9] << 8;
+	e.payload.resize(header[10] | header[11] << 8);
+	return e.payload.empty() || fread(&e.payload[0], 1, e.payload.size(), file) == e.payload.size();
+}
+
+#endif /* JOURNAL_H */
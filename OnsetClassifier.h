@@ -0,0 +1,114 @@
+/*
+ Onset classifier for the piezo.
+ Every threshold crossing opens a short window (a few ms of analog samples). The peak, the rise time to
+ the peak and how far the signal has fallen from the peak by the end of the window are collected as the
+ samples come in, and when the window is full the onset is labelled:
+	BLEED	weaker than the last kick and soon after it (the kick ringing on), or a slow swell that
+		doesn't fall away (another drum or the stage coming through the piezo).
+	KICK	peak at or above kickPeak.
+	GHOST	a quieter hit with a sharp attack or a quick decay.
+ render.cpp drops the bleed and passes the rest on to the tracker. The features are updated in O(1) per sample and the decision is a fixed
+ handful of comparisons, so the worst case per onset is window * (cost of feedOnset) + (cost of
+ classifyOnset) whatever the signal does. Tools/ClassifierBench measures both on the recordings.
+*/
+#ifndef ONSET_CLASSIFIER_H
+#define ONSET_CLASSIFIER_H
+
+enum OnsetClass
+{
+	ONSET_KICK = 0,
+	ONSET_GHOST = 1,
+	ONSET_BLEED = 2
+};
+
+static const char* const onsetClassNames[] = {"kick", "ghost", "bleed"};
+
+// All times in analog samples.
+struct OnsetClassifierParams
+{
+	int window; // samples collected after the crossing, 0 = classifier off (everything is a kick).
+	float kickPeak;
+	int maxRise; // a rise slower than this is a swell.
+	float minDecay; // fraction of the peak that has to be gone by the end of the window.
+	float bleedWindow; // ringing is only looked for this soon after a kick.
+	float bleedRatio; // and only below this fraction of that kick's peak.
+};
+
+struct OnsetFeatures
+{
+	float peak;
+	int rise; // samples from the crossing to the peak.
+	float decay; // fraction of the peak gone by the end of the window.
+};
+
+struct OnsetClassifier
+{
+	bool active; // window open.
+	int count; // samples in the window so far.
+	float peak;
+	int peakIndex;
+	float last;
+	float lastKickPeak;
+	OnsetFeatures features; // of the last classified onset.
+};
+
+// Opens the window on the sample that crossed the threshold. Returns true if there is no window.
+static inline bool startOnset(OnsetClassifier& c, const OnsetClassifierParams& p, float value)
+{
+	c.active = true;
+	c.count = 1;
+	c.peak = value;
+	c.peakIndex = 0;
+	c.last = value;
+	return p.window <= 0;
+}
+
+// Adds the next sample, returns true once the window is full.
+static inline bool feedOnset(OnsetClassifier& c, const OnsetClassifierParams& p, float value)
+{
+	if(value > c.peak)
+	{
+		c.peak = value;
+		c.peakIndex = c.count;
+	}
+	c.last = value;
+	return ++c.count > p.window;
+}
+
+static inline OnsetClass classifyOnset(OnsetClassifier& c, const OnsetClassifierParams& p, float samplesSinceKick)
+{
+	c.active = false;
+	c.features.peak = c.peak;
+	c.features.rise = c.peakIndex;
+	c.features.decay = c.peak > 0 ? (c.peak - c.last) / c.peak : 0;
+
+	OnsetClass result;
+	if(p.window <= 0)
+	{
+		result = ONSET_KICK;
+	}
+	else if(samplesSinceKick < p.bleedWindow && c.peak < p.bleedRatio * c.lastKickPeak)
+	{
+		result = ONSET_BLEED;
+	}
+	else if(c.peak >= p.kickPeak)
+	{
+		result = ONSET_KICK;
+	}
+	else if(c.features.rise <= p.maxRise || c.features.decay >= p.minDecay)
+	{
+		result = ONSET_GHOST;
+	}
+	else
+	{
+		result = ONSET_BLEED;
+	}
+
+	if(result == ONSET_KICK)
+	{
+		c.lastKickPeak = c.peak;
+	}
+	return result;
+}
+
+#endif /* ONSET_CLASSIFIER_H */
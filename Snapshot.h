@@ -0,0 +1,129 @@
+/*
+ A small state snapshot kept in a memory mapped file, so the tracker can pick up where it was after a crash or
+ a power cut (render.cpp's snapshot variables say what goes in it).
+ The file holds two slots and each write goes to the older one, so the newer slot is intact however far a
+ write got before the power went. A slot counts if its magic, version and size match and its checksum is
+ right, and readSnapshot() takes the one with the higher sequence number.
+ writeSnapshot() waits for the page to reach the SD card (msync), so it's only for a non-RT thread.
+*/
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define SNAPSHOT_MAGIC 0x534C5550 // "PULS"
+#define SNAPSHOT_MAX_DATA 2000 // bytes of state per slot, so both fit in one 4 kB page.
+
+struct SnapshotSlot
+{
+	uint32_t magic;
+	uint32_t version; // of the data's layout, so a snapshot from an older build isn't misread.
+	uint32_t size;
+	uint32_t sequence; // 0 while being written.
+	uint32_t checksum; // of the data.
+	unsigned char data[SNAPSHOT_MAX_DATA];
+};
+
+struct SnapshotFile
+{
+	SnapshotSlot* slots; // 2, mapped, 0 if the file couldn't be opened.
+	uint32_t sequence; // of the newest slot.
+};
+
+static inline uint32_t snapshotChecksum(const void* data, size_t size)
+{
+	uint32_t hash = 2166136261u; // FNV-1a
+	for(size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ ((const unsigned char*)data)[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// Opens (or creates) the file and maps it.
+static inline bool openSnapshot(SnapshotFile& f, const char* path)
+{
+	f.slots = 0;
+	f.sequence = 0;
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(fd < 0)
+	{
+		return false;
+	}
+	if(ftruncate(fd, 2 * sizeof(SnapshotSlot)) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	void* map = mmap(0, 2 * sizeof(SnapshotSlot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // The mapping keeps the file.
+	if(map == MAP_FAILED)
+	{
+		return false;
+	}
+	f.slots = (SnapshotSlot*)map;
+	for(int s = 0; s < 2; s++)
+	{
+		if(f.slots[s].magic == SNAPSHOT_MAGIC && f.slots[s].sequence > f.sequence)
+		{
+			f.sequence = f.slots[s].sequence;
+		}
+	}
+	return true;
+}
+
+static inline void closeSnapshot(SnapshotFile& f)
+{
+	if(f.slots)
+	{
+		munmap(f.slots, 2 * sizeof(SnapshotSlot));
+		f.slots = 0;
+	}
+}
+
+// Copies the newest good snapshot of this version and size into data. False if there isn't one.
+static inline bool readSnapshot(const SnapshotFile& f, uint32_t version, void* data, size_t size)
+{
+	const SnapshotSlot* best = 0;
+	for(int s = 0; f.slots && s < 2; s++)
+	{
+		const SnapshotSlot& slot = f.slots[s];
+		if(slot.magic == SNAPSHOT_MAGIC && slot.version == version && slot.size == size && size <= SNAPSHOT_MAX_DATA
+			&& slot.sequence != 0 && slot.checksum == snapshotChecksum(slot.data, size) && (!best || slot.sequence > best->sequence))
+		{
+			best = &slot;
+		}
+	}
+	if(!best)
+	{
+		return false;
+	}
+	memcpy(data, best->data, size);
+	return true;
+}
+
+// Writes data over the older slot and waits for it to be on disk.
+static inline bool writeSnapshot(SnapshotFile& f, uint32_t version, const void* data, size_t size)
+{
+	if(!f.slots || size > SNAPSHOT_MAX_DATA)
+	{
+		return false;
+	}
+	SnapshotSlot& slot = f.slots[f.slots[0].sequence <= f.slots[1].sequence ? 0 : 1];
+	slot.sequence = 0; // Not a candidate until it's complete.
+	slot.magic = SNAPSHOT_MAGIC;
+	slot.version = version;
+	slot.size = size;
+	memcpy(slot.data, data, size);
+	slot.checksum = snapshotChecksum(data, size);
+	__sync_synchronize();
+	slot.sequence = ++f.sequence;
+	return msync(f.slots, 2 * sizeof(SnapshotSlot), MS_SYNC) == 0;
+}
+
+#endif /* SNAPSHOT_H */
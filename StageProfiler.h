@@ -0,0 +1,119 @@
+/*
+ Stage profiling for render().
+ Each stage of the render loop is timed with the CPU cycle counter and the count is dropped into a
+ histogram with power of two buckets, which costs a few instructions per stage per block.
+ The histograms are only written by the render thread; printStageHistogram() is called from an aux task
+ to dump them. A dump can catch a bucket mid-update, which is fine for what these numbers are used for.
+
+ On the Bela the ARM cycle counter (PMCCNTR) can only be read from user space once the PMU user access
+ bit has been set by a kernel module, so it is used when PULSE_PMU_CYCLES is defined and the monotonic
+ clock (ns) is used otherwise. Define STAGE_PROFILING 0 to compile it all out.
+*/
+#ifndef STAGE_PROFILER_H
+#define STAGE_PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef STAGE_PROFILING
+#define STAGE_PROFILING 1
+#endif
+
+#define PROFILE_BUCKETS 32
+
+struct StageHistogram
+{
+	const char* name;
+	uint32_t buckets[PROFILE_BUCKETS]; // bucket b counts readings from 2^(b-1) up to 2^b - 1 (bucket 0 is 0).
+	uint32_t count;
+	uint32_t max;
+	uint64_t total;
+};
+
+#if defined(__arm__) && defined(PULSE_PMU_CYCLES)
+#define PROFILE_UNITS "cycles"
+static inline uint32_t readCycleCounter()
+{
+	uint32_t cycles;
+	asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r"(cycles));
+	return cycles;
+}
+#elif defined(__x86_64__) || defined(__i386__)
+#define PROFILE_UNITS "cycles"
+static inline uint32_t readCycleCounter()
+{
+	uint32_t lo;
+	uint32_t hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return lo;
+}
+#else
+#define PROFILE_UNITS "ns"
+static inline uint32_t readCycleCounter()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+#endif
+
+static inline void recordStage(StageHistogram& h, uint32_t cycles)
+{
+	int bucket = cycles ? 32 - __builtin_clz(cycles) : 0;
+	if(bucket >= PROFILE_BUCKETS)
+	{
+		bucket = PROFILE_BUCKETS - 1;
+	}
+	h.buckets[bucket]++;
+	h.count++;
+	h.total += cycles;
+	if(cycles > h.max)
+	{
+		h.max = cycles;
+	}
+}
+
+static inline void resetStageHistogram(StageHistogram& h)
+{
+	memset(h.buckets, 0, sizeof(h.buckets));
+	h.count = 0;
+	h.max = 0;
+	h.total = 0;
+}
+
+// Not real-time safe, call from an aux task.
+static inline void printStageHistogram(const StageHistogram& h)
+{
+	printf("%-12s count = %u	mean = %.1f	max = %u (%s)\n", h.name, h.count,
+		h.count ? (double)h.total / h.count : 0.0, h.max, PROFILE_UNITS);
+	for(int b = 0; b < PROFILE_BUCKETS; b++)
+	{
+		if(h.buckets[b])
+		{
+			printf("	< %-10u %u\n", 1u << b, h.buckets[b]);
+		}
+	}
+}
+
+// PROFILE_NESTED_END also adds the reading to "nested", so an enclosing stage can leave it out
+// of its own reading with PROFILE_END_EXCLUDING. PROFILE_ACCUMULATE adds a reading to "total" without
+// recording it, for a stage spread over several blocks, and PROFILE_RECORD records the total.
+#if STAGE_PROFILING
+#define PROFILE_START(var) uint32_t var = readCycleCounter()
+#define PROFILE_END(hist, var) recordStage(hist, readCycleCounter() - var)
+#define PROFILE_NESTED_END(hist, var, nested) do { uint32_t c_ = readCycleCounter() - var; recordStage(hist, c_); nested += c_; } while(0)
+#define PROFILE_END_EXCLUDING(hist, var, nested) recordStage(hist, readCycleCounter() - var - nested)
+#define PROFILE_ACCUMULATE(var, total) total += readCycleCounter() - var
+#define PROFILE_RECORD(hist, total) recordStage(hist, total)
+#else
+#define PROFILE_START(var)
+#define PROFILE_END(hist, var)
+#define PROFILE_NESTED_END(hist, var, nested)
+#define PROFILE_END_EXCLUDING(hist, var, nested)
+#define PROFILE_ACCUMULATE(var, total)
+#define PROFILE_RECORD(hist, total)
+#endif
+
+#endif /* STAGE_PROFILER_H */
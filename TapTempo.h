@@ -0,0 +1,115 @@
+/*
+ Tap tempo for TAP_MODE: the tempo from the last TAP_WINDOW inter-onset intervals, robust to the odd bad tap.
+ A flam or a stray note adds short IOIs and a missed tap doubles one; a plain mean follows all of them. Here
+ the median of the window picks the tempo, and the estimate is the mean of the IOIs within TAP_TOLERANCE of it,
+ so anything up to half the window can be wrong (in either direction) without moving it, while the good IOIs
+ are still all averaged.
+ The window is kept twice: as a ring, to know which IOI is the oldest, and sorted, for the median and the range.
+ Adding a tap finds the oldest and the new one's place in the sorted copy by binary search and moves only the
+ entries between them, so never more than TAP_WINDOW. The estimate sums at most TAP_WINDOW IOIs afresh each
+ time, so nothing drifts over a long set.
+ A few hundred bytes and a fixed number of steps, so it can run (and be reset) on the render thread.
+ Tools/TapBench compares it with the old mean of the last four IOIs on synthetic tapping.
+*/
+#ifndef TAP_TEMPO_H
+#define TAP_TEMPO_H
+
+#define TAP_WINDOW 12 // IOIs the tempo is taken from.
+#define TAP_TOLERANCE 0.2f // fraction of the median an IOI can be off by and still be averaged.
+
+struct TapTempo
+{
+	float iois[TAP_WINDOW]; // ring (ms), oldest at next once full.
+	float sorted[TAP_WINDOW]; // the same IOIs, ascending.
+	int count;
+	int next;
+};
+
+// Only the counts: the IOIs past count are never read.
+static inline void resetTapTempo(TapTempo& t)
+{
+	t.count = 0;
+	t.next = 0;
+}
+
+// First of the n sorted IOIs above ms (or at or above it, with orEqual).
+static inline int tapSearch(const float* sorted, int n, float ms, bool orEqual)
+{
+	int lo = 0;
+	int hi = n;
+	while(lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if(sorted[mid] < ms || (!orEqual && sorted[mid] == ms))
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// Adds an IOI (ms), dropping the oldest once the window is full.
+static inline void addTap(TapTempo& t, float ms)
+{
+	float ioi = ms > 0 ? ms : 0;
+	int place = tapSearch(t.sorted, t.count, ioi, false);
+	if(t.count == TAP_WINDOW) // The new one takes the oldest's slot, sliding along only what lies between them.
+	{
+		int oldest = tapSearch(t.sorted, t.count, t.iois[t.next], true);
+		if(place > oldest)
+		{
+			place--;
+			for(int i = oldest; i < place; i++)
+			{
+				t.sorted[i] = t.sorted[i + 1];
+			}
+		}
+		else
+		{
+			for(int i = oldest; i > place; i--)
+			{
+				t.sorted[i] = t.sorted[i - 1];
+			}
+		}
+	}
+	else
+	{
+		for(int i = t.count; i > place; i--)
+		{
+			t.sorted[i] = t.sorted[i - 1];
+		}
+		t.count++;
+	}
+	t.sorted[place] = ioi;
+	t.iois[t.next] = ioi;
+	t.next = (t.next + 1) % TAP_WINDOW;
+}
+
+// The IOI the window agrees on (ms), 0 with no IOIs yet.
+static inline float tapEstimate(const TapTempo& t)
+{
+	int n = t.count;
+	if(n == 0)
+	{
+		return 0;
+	}
+	float median = (t.sorted[(n - 1) / 2] + t.sorted[n / 2]) / 2; // the middle one, or the middle two for an even count.
+	int first = tapSearch(t.sorted, n, median * (1 - TAP_TOLERANCE), true);
+	int last = tapSearch(t.sorted, n, median * (1 + TAP_TOLERANCE), false);
+	if(last == first) // Only if the middle two are far apart, so the median is the best there is.
+	{
+		return median;
+	}
+	float sum = 0;
+	for(int i = first; i < last; i++)
+	{
+		sum += t.sorted[i];
+	}
+	return sum / (last - first);
+}
+
+#endif /* TAP_TEMPO_H */
@@ -0,0 +1,142 @@
+/*
+ Sample accurate timers for render(), kept in a hashed timer wheel.
+ A timer is due at an absolute audio frame. The wheel has one slot per block (TIMER_WHEEL_SLOTS of them, used
+ round and round), so a timer goes in the slot of the block it is due in, and each block only looks at its own
+ slot: scheduling and cancelling touch one short list, and a block with nothing due costs one empty slot.
+ Timers more than a lap ahead share a slot with nearer ones and are skipped until their lap comes round.
+ A timer scheduled for a frame that has already gone is due at the start of the current block, and so is one
+ left in a block that was skipped.
+
+ render() calls advanceTimerWheel() at the start of each block and then nextTimer() until it returns 0, which
+ hands the block's due timers out in time order with their frame within the block. A handler can schedule
+ timers again, including later in the same block (a periodic timer reschedules itself).
+ Timers are plain structs owned by the caller, so there is no allocation, and everything is render thread only.
+*/
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define TIMER_WHEEL_SLOTS 256 // a power of two, about 93 ms of blocks at -p 16.
+
+struct Timer
+{
+	int id; // what the caller dispatches on.
+	bool armed;
+	uint64_t due; // audio frame.
+	Timer* next; // in its slot.
+};
+
+struct TimerWheel
+{
+	Timer* slots[TIMER_WHEEL_SLOTS];
+	unsigned int blockFrames;
+	uint64_t blockStart; // first frame of the current block.
+};
+
+static inline void initTimerWheel(TimerWheel& w, unsigned int blockFrames)
+{
+	memset(w.slots, 0, sizeof(w.slots));
+	w.blockFrames = blockFrames;
+	w.blockStart = 0;
+}
+
+static inline Timer** timerSlot(TimerWheel& w, uint64_t frame)
+{
+	return &w.slots[(frame / w.blockFrames) & (TIMER_WHEEL_SLOTS - 1)];
+}
+
+static inline void cancelTimer(TimerWheel& w, Timer& t)
+{
+	if(!t.armed)
+		return;
+	for(Timer** link = timerSlot(w, t.due); *link; link = &(*link)->next)
+	{
+		if(*link == &t)
+		{
+			*link = t.next;
+			break;
+		}
+	}
+	t.armed = false;
+}
+
+// (Re)schedules the timer for an audio frame.
+static inline void scheduleTimer(TimerWheel& w, Timer& t, uint64_t due)
+{
+	cancelTimer(w, t);
+	t.due = due < w.blockStart ? w.blockStart : due;
+	Timer** slot = timerSlot(w, t.due);
+	t.next = *slot;
+	*slot = &t;
+	t.armed = true;
+}
+
+// Moves on to the block starting at blockStart. If blocks were skipped (an xrun), the timers due in them are
+// overdue, so they are moved to the start of this block rather than left in slots nothing will look at until
+// their lap comes round again (or ever, for a timer that only the handler reschedules). They go first in the
+// slot in the order they were due, which nextTimer() keeps as they all tie.
+static inline void advanceTimerWheel(TimerWheel& w, uint64_t blockStart)
+{
+	uint64_t expected = w.blockStart + w.blockFrames;
+	w.blockStart = blockStart;
+	if(blockStart <= expected)
+		return;
+	uint64_t skipped = (blockStart - expected) / w.blockFrames;
+	if(skipped > TIMER_WHEEL_SLOTS)
+		skipped = TIMER_WHEEL_SLOTS;
+	Timer* overdue = 0; // sorted by due.
+	for(uint64_t b = 0; b < skipped; b++)
+	{
+		Timer** link = timerSlot(w, expected + b * w.blockFrames);
+		while(*link)
+		{
+			Timer* t = *link;
+			if(t->due < blockStart)
+			{
+				*link = t->next;
+				Timer** place = &overdue;
+				while(*place && (*place)->due <= t->due)
+					place = &(*place)->next;
+				t->next = *place;
+				*place = t;
+			}
+			else
+			{
+				link = &t->next;
+			}
+		}
+	}
+	Timer** current = timerSlot(w, blockStart);
+	while(overdue)
+	{
+		Timer* t = overdue;
+		overdue = t->next;
+		t->due = blockStart;
+		t->next = *current;
+		*current = t;
+		current = &t->next;
+	}
+}
+
+// The earliest timer due in the current block, taken off the wheel, with its frame in the block. 0 once there are none.
+static inline Timer* nextTimer(TimerWheel& w, unsigned int& frame)
+{
+	uint64_t blockEnd = w.blockStart + w.blockFrames;
+	Timer** earliest = 0;
+	for(Timer** link = timerSlot(w, w.blockStart); *link; link = &(*link)->next)
+	{
+		if((*link)->due < blockEnd && (!earliest || (*link)->due < (*earliest)->due))
+			earliest = link;
+	}
+	if(!earliest)
+		return 0;
+	Timer* t = *earliest;
+	*earliest = t->next;
+	t->armed = false;
+	frame = t->due - w.blockStart;
+	return t;
+}
+
+#endif /* TIMER_WHEEL_H */
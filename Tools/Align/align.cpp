@@ -0,0 +1,362 @@
+/*
+ Lead and lag between two streams of a session (Tools/Host/Session.h), by windowed cross-correlation. By
+ default the ankle sensor against the piezo in the Comparison Study, which were logged side by side to compare
+ the two ways of sensing the drummer: how far ahead of (or behind) the hit the foot's movement is, and whether
+ that holds over the whole session.
+ Both streams are resampled onto one grid (--rate), cut into windows (--window s, every --hop s), and each
+ window of each has its mean taken out and a Hann window put on. The cross-correlation of the two over
+ +-maxlag is taken through an FFT: both windows go in as one complex signal (piezo real, ankle imaginary) and are
+ pulled apart again after the transform, so a window costs one FFT there and one back. Its largest magnitude
+ gives the lag (refined between frames with a parabola) and the correlation there, normalised so 1 is a
+ perfect match. A negative correlation is a match too (the ankle's y axis goes down as the foot goes down) and
+ is kept with its sign. A positive lag is the ankle after the piezo, a negative one the ankle ahead of it.
+ Windows correlating less than --min are left out of the summary: the median lag and its quartiles, the mean
+ correlation, and the drift of the lag over the session (a straight line fit, ms per minute).
+ --velocity correlates the ankle's rate of change instead of its position, --print lists every window and
+ --csv writes them as CSV. --sweep runs the summary for window sizes from 0.25 s to 16 s, with the time each
+ took, to find the one that suits.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -ITools/Host Tools/Host/SensorLog.cpp Tools/Host/Session.cpp Tools/Align/align.cpp -o align
+	./align [--window 4] [--hop s] [--maxlag 0.2] [--rate 1000] [--min 0.2] [--velocity] [--print | --csv | --sweep]
+		[--dir Earlier_Dev/Comparison_Test] [--prefix Comparison_Study] [--a Piezo] [--b Ankle_Sensor[yAxis]]
+*/
+#include "Session.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+typedef std::complex<double> Complex;
+
+struct AlignWindow
+{
+	float time; // s, the window's centre.
+	float lag; // ms, the ankle (b) after the piezo (a).
+	float correlation; // -1 to 1.
+};
+
+struct AlignSummary
+{
+	size_t windows;
+	size_t used; // correlating at least --min.
+	float median; // ms
+	float lower; // quartiles (ms)
+	float upper;
+	float correlation; // mean |correlation| of those used.
+	float drift; // ms per minute.
+	double seconds; // to compute.
+};
+
+// In place radix 2 FFT of a power of two length, twiddles and bit reversal worked out once per size.
+class FFT
+{
+public:
+	void transform(std::vector<Complex>& x)
+	{
+		size_t n = x.size();
+		if(n != twiddles.size())
+			prepare(n);
+		for(size_t i = 0; i < n; i++)
+		{
+			if(i < reversed[i])
+				std::swap(x[i], x[reversed[i]]);
+		}
+		for(size_t length = 2; length <= n; length <<= 1)
+		{
+			size_t step = n / length;
+			for(size_t start = 0; start < n; start += length)
+			{
+				for(size_t k = 0; k < length / 2; k++)
+				{
+					Complex t = twiddles[k * step] * x[start + k + length / 2];
+					x[start + k + length / 2] = x[start + k] - t;
+					x[start + k] += t;
+				}
+			}
+		}
+	}
+
+private:
+	void prepare(size_t n)
+	{
+		twiddles.resize(n);
+		reversed.resize(n);
+		int bits = 0;
+		while((1u << bits) < n)
+			bits++;
+		for(size_t i = 0; i < n; i++)
+		{
+			twiddles[i] = std::polar(1.0, -2 * M_PI * i / n);
+			size_t r = 0;
+			for(int b = 0; b < bits; b++)
+				r |= ((i >> b) & 1) << (bits - 1 - b);
+			reversed[i] = r;
+		}
+	}
+
+	std::vector<Complex> twiddles;
+	std::vector<size_t> reversed;
+};
+
+static double secondsSince(const struct timespec& start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+// Cross-correlates a and b window by window.
+static void correlate(const float* a, const float* b, size_t frames, float rate, float window, float hop, float maxLag,
+	std::vector<AlignWindow>& windows)
+{
+	windows.clear();
+	size_t n = window * rate + 0.5f;
+	size_t step = std::max(1.f, hop * rate + 0.5f);
+	int lags = std::min((size_t)(maxLag * rate + 0.5f), n - 1);
+	if(n < 4 || n > frames)
+		return;
+	size_t size = 1;
+	while(size < 2 * n) // no wrap around between the lags.
+		size <<= 1;
+	std::vector<double> hann(n);
+	for(size_t i = 0; i < n; i++)
+		hann[i] = 0.5 - 0.5 * cos(2 * M_PI * i / (n - 1));
+
+	FFT fft;
+	std::vector<Complex> x(size);
+	std::vector<Complex> product(size);
+	for(size_t from = 0; from + n <= frames; from += step)
+	{
+		double meanA = 0, meanB = 0;
+		for(size_t i = 0; i < n; i++)
+		{
+			meanA += a[from + i];
+			meanB += b[from + i];
+		}
+		meanA /= n;
+		meanB /= n;
+		double energyA = 0, energyB = 0;
+		for(size_t i = 0; i < n; i++)
+		{
+			double va = (a[from + i] - meanA) * hann[i];
+			double vb = (b[from + i] - meanB) * hann[i];
+			energyA += va * va;
+			energyB += vb * vb;
+			x[i] = Complex(va, vb);
+		}
+		std::fill(x.begin() + n, x.end(), Complex(0, 0));
+		AlignWindow w = {(float)((from + n / 2.0) / rate), 0, 0};
+		if(energyA <= 0 || energyB <= 0) // a flat window matches nothing.
+		{
+			windows.push_back(w);
+			continue;
+		}
+
+		// A and B from the one transform, then conj(A) B, whose inverse is sum a[i] b[i + lag].
+		fft.transform(x);
+		for(size_t k = 0; k < size; k++)
+		{
+			Complex z = x[k];
+			Complex mirror = std::conj(x[(size - k) & (size - 1)]);
+			Complex spectrumA = (z + mirror) * 0.5;
+			Complex spectrumB = (z - mirror) * Complex(0, -0.5);
+			product[k] = std::conj(std::conj(spectrumA) * spectrumB); // conjugated, so the forward FFT inverts it.
+		}
+		fft.transform(product);
+		double scale = 1.0 / (size * sqrt(energyA * energyB));
+
+		int best = 0;
+		double bestValue = 0;
+		for(int lag = -lags; lag <= lags; lag++)
+		{
+			double value = product[(lag + size) & (size - 1)].real() * scale;
+			if(fabs(value) > fabs(bestValue))
+			{
+				best = lag;
+				bestValue = value;
+			}
+		}
+		double offset = 0;
+		if(best > -lags && best < lags)
+		{
+			double before = fabs(product[(best - 1 + size) & (size - 1)].real());
+			double at = fabs(product[(best + size) & (size - 1)].real());
+			double after = fabs(product[(best + 1 + size) & (size - 1)].real());
+			double curve = before - 2 * at + after;
+			if(curve < 0)
+				offset = 0.5 * (before - after) / curve;
+		}
+		w.lag = (best + offset) * 1000 / rate;
+		w.correlation = bestValue;
+		windows.push_back(w);
+	}
+}
+
+static float quantile(std::vector<float> values, float q)
+{
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, (size_t)(q * values.size()))];
+}
+
+static void summarise(const std::vector<AlignWindow>& windows, float minimum, AlignSummary& s)
+{
+	s.windows = windows.size();
+	s.used = 0;
+	s.median = s.lower = s.upper = s.correlation = s.drift = 0;
+	std::vector<float> lags;
+	double st = 0, sl = 0, stt = 0, stl = 0;
+	for(size_t i = 0; i < windows.size(); i++)
+	{
+		const AlignWindow& w = windows[i];
+		if(fabsf(w.correlation) < minimum)
+			continue;
+		lags.push_back(w.lag);
+		s.correlation += fabsf(w.correlation);
+		double t = w.time / 60;
+		st += t;
+		sl += w.lag;
+		stt += t * t;
+		stl += t * w.lag;
+	}
+	s.used = lags.size();
+	if(lags.empty())
+		return;
+	s.median = quantile(lags, 0.5f);
+	s.lower = quantile(lags, 0.25f);
+	s.upper = quantile(lags, 0.75f);
+	s.correlation /= lags.size();
+	double d = lags.size() * stt - st * st;
+	if(lags.size() > 1 && d > 0)
+		s.drift = (lags.size() * stl - st * sl) / d;
+}
+
+static void printSummary(float window, const AlignSummary& s)
+{
+	printf("window %6.2f s  %5zu of %5zu windows  lag %7.1f ms (quartiles %7.1f %7.1f)  |r| %.2f  drift %6.2f ms/min  %7.2f ms\n",
+		window, s.used, s.windows, s.median, s.lower, s.upper, s.correlation, s.drift, s.seconds * 1000);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* directory = "Earlier_Dev/Comparison_Test";
+	const char* prefix = "Comparison_Study";
+	const char* nameA = "Piezo";
+	const char* nameB = "Ankle_Sensor[yAxis]";
+	float rate = 1000;
+	float window = 4;
+	float hop = -1; // half the window.
+	float maxLag = 0.2f;
+	float minimum = 0.2f;
+	bool velocity = false;
+	bool print = false;
+	bool csv = false;
+	bool sweep = false;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--window") && i + 1 < argc)
+			window = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--hop") && i + 1 < argc)
+			hop = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--maxlag") && i + 1 < argc)
+			maxLag = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--rate") && i + 1 < argc)
+			rate = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--min") && i + 1 < argc)
+			minimum = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--velocity"))
+			velocity = true;
+		else if(!strcmp(argv[i], "--print"))
+			print = true;
+		else if(!strcmp(argv[i], "--csv"))
+			csv = true;
+		else if(!strcmp(argv[i], "--sweep"))
+			sweep = true;
+		else if(!strcmp(argv[i], "--dir") && i + 1 < argc)
+			directory = argv[++i];
+		else if(!strcmp(argv[i], "--prefix") && i + 1 < argc)
+			prefix = argv[++i];
+		else if(!strcmp(argv[i], "--a") && i + 1 < argc)
+			nameA = argv[++i];
+		else if(!strcmp(argv[i], "--b") && i + 1 < argc)
+			nameB = argv[++i];
+		else
+		{
+			printf("Usage: %s [--window s] [--hop s] [--maxlag s] [--rate Hz] [--min r] [--velocity] [--print | --csv | --sweep]\n"
+				"	[--dir directory] [--prefix session] [--a stream] [--b stream]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(rate <= 0 || window <= 0 || maxLag <= 0)
+		return 2;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	Session session;
+	if(!session.open(directory, prefix))
+		return 1;
+	SessionFrame frame;
+	size_t frames = session.duration() * rate;
+	session.resample(0, rate, frames, frame);
+	int a = frame.find(nameA);
+	int b = frame.find(nameB);
+	if(a < 0 || b < 0)
+	{
+		fprintf(stderr, "The session has no %s stream\n", a < 0 ? nameA : nameB);
+		return 1;
+	}
+	std::vector<float> streamB(frame.stream(b), frame.stream(b) + frames);
+	if(velocity)
+	{
+		for(size_t k = frames; k-- > 1;)
+			streamB[k] = (streamB[k] - streamB[k - 1]) * rate;
+		if(frames)
+			streamB[0] = frames > 1 ? streamB[1] : 0;
+	}
+	double loadSeconds = secondsSince(start);
+
+	std::vector<AlignWindow> windows;
+	AlignSummary summary;
+	if(sweep)
+	{
+		printf("%s against %s, %.1f s at %.0f Hz (opened and resampled in %.1f ms), lags up to %.0f ms\n", nameB, nameA,
+			frames / rate, rate, loadSeconds * 1000, maxLag * 1000);
+		for(float size = 0.25f; size <= 16; size *= 2)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			correlate(frame.stream(a), &streamB[0], frames, rate, size, hop > 0 ? hop : size / 2, maxLag, windows);
+			summarise(windows, minimum, summary);
+			summary.seconds = secondsSince(start);
+			printSummary(size, summary);
+		}
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	correlate(frame.stream(a), &streamB[0], frames, rate, window, hop > 0 ? hop : window / 2, maxLag, windows);
+	summarise(windows, minimum, summary);
+	summary.seconds = secondsSince(start);
+	if(csv)
+	{
+		printf("time,lag_ms,correlation\n");
+		for(size_t i = 0; i < windows.size(); i++)
+			printf("%.3f,%.2f,%.4f\n", windows[i].time, windows[i].lag, windows[i].correlation);
+		return 0;
+	}
+	if(print)
+	{
+		for(size_t i = 0; i < windows.size(); i++)
+		{
+			printf("%8.2f s  lag %7.1f ms  r %6.3f%s\n", windows[i].time, windows[i].lag, windows[i].correlation,
+				fabsf(windows[i].correlation) < minimum ? "  (left out)" : "");
+		}
+	}
+	printf("%s against %s, %.1f s at %.0f Hz (opened and resampled in %.1f ms), lags up to %.0f ms\n", nameB, nameA,
+		frames / rate, rate, loadSeconds * 1000, maxLag * 1000);
+	printSummary(window, summary);
+	return 0;
+}
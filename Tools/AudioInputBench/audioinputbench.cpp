@@ -0,0 +1,176 @@
+/*
+ Audio input onset detector benchmark: what AudioOnsetDetector.h finds in the raw audio captures, and what
+ it costs per render() block. The capture (32 bit floats, mono, 44.1 kHz) is fed through the detector in
+ blocks of BLOCK_FRAMES audio frames, one level per analog frame, exactly as render() does at -p 16, and onsets
+ are found in the levels with render.cpp's thresholds and retrigger timeout. Each block is run REPEATS times and
+ timed with StageProfiler.h's counter (less the cost of reading the counter), which gives the 99.9th percentile
+ and worst cost per block, and the monotonic clock gives the mean, as a share of the block's real time.
+ On the Bela the same number comes from the "audioInput" histogram of "/pulse/profile/dump".
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -I. -ITools/Host Tools/AudioInputBench/audioinputbench.cpp -o audioinputbench
+	./audioinputbench [--cutoff Hz] [--gain g] [capture ...]
+*/
+#include "AudioOnsetDetector.h"
+#include "StageProfiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#define AUDIO_RATE 44100.f
+#define BLOCK_FRAMES 16 // -p 16
+#define FRAMES_PER_ANALOG 2 // 8 analog channels run at half the audio rate.
+#define ONSET_THRESHOLD 0.3f // render.cpp's defaultParams from here down.
+#define RELEASE_THRESHOLD 0.05f
+#define TIMEOUT_SAMPLES 5000
+#define AUDIO_CUTOFF 150.f
+#define AUDIO_GAIN 4.f
+#define AUDIO_RELEASE 10.f
+#define REPEATS 50
+
+const char* defaultCaptures[] = {
+	"Earlier_Dev/Sensors-_OSC/C1a_Audio",
+	"Earlier_Dev/Comparison_Test/Comparison_Audio",
+};
+
+static bool loadCapture(const char* path, std::vector<float>& samples)
+{
+	FILE* file = fopen(path, "rb");
+	if(!file)
+		return false;
+	float buffer[4096];
+	size_t count;
+	while((count = fread(buffer, sizeof(float), 4096, file)) > 0)
+	{
+		samples.insert(samples.end(), buffer, buffer + count);
+	}
+	fclose(file);
+	return samples.size() >= BLOCK_FRAMES;
+}
+
+static uint32_t counterOverhead()
+{
+	uint32_t best = ~0u;
+	for(int i = 0; i < 1000; i++)
+	{
+		uint32_t start = readCycleCounter();
+		best = std::min(best, readCycleCounter() - start);
+	}
+	return best;
+}
+
+// One render() block's worth of the detector.
+static void detectBlock(AudioOnsetDetector& d, const AudioOnsetParams& p, const float* audio, float* levels)
+{
+	for(int n = 0; n < BLOCK_FRAMES / FRAMES_PER_ANALOG; n++)
+	{
+		for(int a = n * FRAMES_PER_ANALOG; a < (n + 1) * FRAMES_PER_ANALOG; a++)
+		{
+			feedAudioOnset(d, p, audio[a]);
+		}
+		levels[n] = audioOnsetLevel(d, p);
+	}
+}
+
+static void bench(const char* path, float cutoff, float gain, uint32_t overhead)
+{
+	std::vector<float> audio;
+	if(!loadCapture(path, audio))
+		return;
+	AudioOnsetParams p;
+	setAudioOnsetParams(p, AUDIO_RATE, FRAMES_PER_ANALOG, cutoff, gain, AUDIO_RELEASE);
+
+	size_t blocks = audio.size() / BLOCK_FRAMES;
+	std::vector<float> levels(blocks * BLOCK_FRAMES / FRAMES_PER_ANALOG);
+	std::vector<uint32_t> perBlock;
+	perBlock.reserve(blocks * REPEATS);
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int r = 0; r < REPEATS; r++)
+	{
+		AudioOnsetDetector d = {};
+		for(size_t b = 0; b < blocks; b++)
+		{
+			uint32_t begin = readCycleCounter();
+			detectBlock(d, p, &audio[b * BLOCK_FRAMES], &levels[b * BLOCK_FRAMES / FRAMES_PER_ANALOG]);
+			uint32_t cycles = readCycleCounter() - begin;
+			perBlock.push_back(cycles > overhead ? cycles - overhead : 0);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double meanNs = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ((double)blocks * REPEATS);
+
+	// Onsets the way render() finds them in the levels.
+	std::vector<size_t> onsets;
+	float peak = 0;
+	bool trig = false;
+	int timeOut = 0;
+	for(size_t n = 0; n < levels.size(); n++)
+	{
+		peak = std::max(peak, levels[n]);
+		if(trig)
+			timeOut++;
+		if(!trig && levels[n] > ONSET_THRESHOLD)
+		{
+			onsets.push_back(n);
+			trig = true;
+		}
+		if(trig && levels[n] < RELEASE_THRESHOLD && timeOut > TIMEOUT_SAMPLES)
+		{
+			trig = false;
+			timeOut = 0;
+		}
+	}
+
+	float analogRate = AUDIO_RATE / FRAMES_PER_ANALOG;
+	printf("%-50s %.2f s, %zu onsets, highest level %.3f\n	", path, audio.size() / AUDIO_RATE, onsets.size(), peak);
+	for(size_t i = 0; i < onsets.size(); i++)
+		printf("%.3f ", onsets[i] / analogRate);
+	printf("\n");
+	std::sort(perBlock.begin(), perBlock.end());
+	double blockNs = BLOCK_FRAMES / AUDIO_RATE * 1e9;
+	printf("	per block (%d frames) p99.9 %u worst %u %s, mean %.0f ns = %.3f%% of the block's %.1f us\n", BLOCK_FRAMES,
+		perBlock[perBlock.size() * 999 / 1000], perBlock.back(), PROFILE_UNITS, meanNs, 100 * meanNs / blockNs, blockNs / 1000);
+}
+
+int main(int argc, char* argv[])
+{
+	float cutoff = AUDIO_CUTOFF;
+	float gain = AUDIO_GAIN;
+	std::vector<const char*> paths;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--cutoff") && i + 1 < argc)
+			cutoff = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--gain") && i + 1 < argc)
+			gain = atof(argv[++i]);
+		else if(argv[i][0] == '-')
+		{
+			printf("Usage: %s [--cutoff Hz] [--gain g] [capture ...]\n", argv[0]);
+			return 2;
+		}
+		else
+			paths.push_back(argv[i]);
+	}
+	bool defaults = paths.empty();
+	if(defaults)
+		paths.assign(defaultCaptures, defaultCaptures + sizeof(defaultCaptures) / sizeof(defaultCaptures[0]));
+
+	uint32_t overhead = counterOverhead();
+	for(size_t i = 0; i < paths.size(); i++)
+	{
+		FILE* file = fopen(paths[i], "rb");
+		if(!file)
+		{
+			if(!defaults) // not every session has a capture.
+				printf("%s: can't be read\n", paths[i]);
+			continue;
+		}
+		fclose(file);
+		bench(paths[i], cutoff, gain, overhead);
+	}
+	return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ Audio-rate onset detector for the raw audio captures (WriteFile kBinary: 32 bit floats, mono, 44.1 kHz),
+ to give a reference set of onsets to hold the piezo detector's timing against.
+
+ The capture is mapped, not read. Its energy is taken in blocks of BLOCK samples (1.45 ms), with the
+ block mean taken off so the DC offset of the input doesn't count, using 4 wide float vectors (GCC vector
+ extensions, so SSE on the laptop and NEON on the Bela). The blocks are shared out between threads. The
+ detection function is how far a block's energy is above the mean of the HISTORY blocks before it (dB), an
+ onset is a peak of it above THRESHOLD_DB, in a block louder than FLOOR_DB, at least MIN_GAP_MS after the last, and its time is the first
+ sample in the block that is that far above the history.
+
+ For each capture <name>_Onsets.txt is written next to it (or in --out): a ' separated log the replay (Tools/Host/Replay.h) plays
+ straight in as a piezo, 1.0 from each onset for PULSE_MS and 0 otherwise, so each onset is two rows.
+ With --compare the piezo log's onsets (render.cpp's thresholds) are matched to the audio onsets.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -ITools/Host Tools/Host/SensorLog.cpp Tools/AudioOnsets/audioonsets.cpp -o audioonsets
+	./audioonsets [--out directory] [--threads n] [--compare piezo.txt] [capture ...]
+*/
+#include "SensorLog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SAMPLE_RATE 44100.f
+#define BLOCK 64 // samples, a multiple of 4.
+#define HISTORY 8 // blocks the energy is compared with (11.6 ms).
+#define THRESHOLD_DB 6.f
+#define FLOOR_DB -60.f // blocks quieter than this are never onsets, however quiet the history was.
+#define MIN_GAP_MS 50.f
+#define PULSE_MS 5.f
+#define PIEZO_ONSET 0.3f // render.cpp's defaultParams.
+#define PIEZO_RELEASE 0.05f
+#define PIEZO_REFRACTORY_MS 227.f
+#define MATCH_MS 50.f // piezo and audio onsets further apart than this aren't the same hit.
+
+const char* defaultCaptures[] = {
+	"Earlier_Dev/Sensors-_OSC/C1a_Audio",
+	"Earlier_Dev/Comparison_Test/Comparison_Audio",
+};
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+// Energy of each block about its own mean.
+static void blockEnergies(const float* audio, size_t firstBlock, size_t lastBlock, float* energy)
+{
+	for(size_t b = firstBlock; b < lastBlock; b++)
+	{
+		const float* x = audio + b * BLOCK;
+		v4sf sum = {0, 0, 0, 0};
+		v4sf squares = {0, 0, 0, 0};
+		for(int i = 0; i < BLOCK; i += 4)
+		{
+			v4sf v;
+			memcpy(&v, x + i, sizeof(v)); // the map is page aligned, so this is an aligned load.
+			sum += v;
+			squares += v * v;
+		}
+		float s = sum[0] + sum[1] + sum[2] + sum[3];
+		float q = squares[0] + squares[1] + squares[2] + squares[3];
+		energy[b] = std::max(0.f, q / BLOCK - (s / BLOCK) * (s / BLOCK));
+	}
+}
+
+static std::vector<double> detect(const float* audio, size_t length, int threads)
+{
+	size_t blocks = length / BLOCK;
+	std::vector<float> energy(blocks);
+	if(threads <= 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> workers;
+	for(int t = 1; t < threads; t++)
+	{
+		workers.push_back(std::thread(blockEnergies, audio, blocks * t / threads, blocks * (t + 1) / threads, &energy[0]));
+	}
+	blockEnergies(audio, 0, blocks / threads, &energy[0]);
+	for(size_t w = 0; w < workers.size(); w++)
+	{
+		workers[w].join();
+	}
+
+	// Detection function: dB above the mean of the history.
+	std::vector<float> rise(blocks, 0.f);
+	std::vector<float> history(blocks, 0.f);
+	double running = 0;
+	for(size_t b = 0; b < blocks; b++)
+	{
+		if(b >= HISTORY)
+		{
+			history[b] = running / HISTORY;
+			rise[b] = 10 * log10f((energy[b] + 1e-12f) / (history[b] + 1e-12f));
+			running -= energy[b - HISTORY];
+		}
+		running += energy[b];
+	}
+
+	std::vector<double> onsets;
+	double lastOnset = -1e9;
+	float floor = powf(10.f, FLOOR_DB / 10);
+	for(size_t b = HISTORY; b + 1 < blocks; b++)
+	{
+		if(rise[b] < THRESHOLD_DB || energy[b] < floor || rise[b] < rise[b - 1] || rise[b] < rise[b + 1])
+			continue;
+		// First sample of the block (or the one before, if it started there) that is as far above the history.
+		const float* x = audio + (b - 1) * BLOCK;
+		float mean = 0;
+		for(int i = 0; i < BLOCK; i++)
+			mean += audio[(b - HISTORY) * BLOCK + i];
+		mean /= BLOCK;
+		float level = history[b] * powf(10.f, THRESHOLD_DB / 10);
+		int first = 2 * BLOCK - 1;
+		for(int i = 0; i < 2 * BLOCK; i++)
+		{
+			if((x[i] - mean) * (x[i] - mean) > level)
+			{
+				first = i;
+				break;
+			}
+		}
+		double t = ((b - 1) * BLOCK + first) / SAMPLE_RATE;
+		if((t - lastOnset) * 1000 >= MIN_GAP_MS)
+		{
+			onsets.push_back(t);
+			lastOnset = t;
+		}
+	}
+	return onsets;
+}
+
+static bool writeOnsets(const std::string& path, const std::vector<double>& onsets)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if(!file)
+		return false;
+	fprintf(file, "%.4f'%.4f\n", 0.0, 0.0);
+	for(size_t i = 0; i < onsets.size(); i++)
+	{
+		fprintf(file, "%.4f'%.4f\n", onsets[i], 1.0);
+		fprintf(file, "%.4f'%.4f\n", onsets[i] + PULSE_MS / 1000, 0.0);
+	}
+	return fclose(file) == 0;
+}
+
+// Piezo onsets found the way render() finds them, each row held until the next as the replay holds it.
+static std::vector<double> piezoOnsets(const SensorLog& log)
+{
+	std::vector<double> onsets;
+	bool triggered = false;
+	double last = -1e9;
+	for(size_t i = 0; i < log.times.size(); i++)
+	{
+		double t = log.times[i];
+		float value = log.channels[0][i];
+		double held = i + 1 < log.times.size() ? log.times[i + 1] : t;
+		if(!triggered && value > PIEZO_ONSET)
+		{
+			onsets.push_back(t);
+			triggered = true;
+			last = t;
+		}
+		else if(triggered && value < PIEZO_RELEASE && (held - last) * 1000 > PIEZO_REFRACTORY_MS)
+		{
+			triggered = false;
+		}
+	}
+	return onsets;
+}
+
+static void compare(const std::vector<double>& audio, const char* piezoPath)
+{
+	SensorLog log;
+	if(!parseSensorLog(piezoPath, log) || log.format != LOG_SENSOR || log.channels.empty())
+		return;
+	std::vector<double> piezo = piezoOnsets(log);
+	double sum = 0;
+	double squares = 0;
+	int matched = 0;
+	for(size_t i = 0; i < piezo.size(); i++)
+	{
+		std::vector<double>::const_iterator next = std::lower_bound(audio.begin(), audio.end(), piezo[i]);
+		double offset = 1e9;
+		if(next != audio.end())
+			offset = piezo[i] - *next;
+		if(next != audio.begin() && fabs(piezo[i] - next[-1]) < fabs(offset))
+			offset = piezo[i] - next[-1];
+		if(fabs(offset) * 1000 < MATCH_MS)
+		{
+			sum += offset * 1000;
+			squares += offset * offset * 1e6;
+			matched++;
+		}
+	}
+	double mean = matched ? sum / matched : 0;
+	printf("	%s: %zu piezo onsets, %d matched, piezo - audio %.2f ms mean, %.2f ms sd\n", piezoPath, piezo.size(), matched,
+		mean, matched ? sqrt(std::max(0.0, squares / matched - mean * mean)) : 0.0);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* out = 0; // next to each capture.
+	int threads = 0;
+	const char* piezo = 0;
+	std::vector<const char*> captures;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--out") && i + 1 < argc)
+			out = argv[++i];
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--compare") && i + 1 < argc)
+			piezo = argv[++i];
+		else if(argv[i][0] == '-')
+		{
+			printf("Usage: %s [--out directory] [--threads n] [--compare piezo.txt] [capture ...]\n", argv[0]);
+			return 2;
+		}
+		else
+			captures.push_back(argv[i]);
+	}
+	bool defaults = captures.empty();
+	if(defaults)
+		captures.assign(defaultCaptures, defaultCaptures + sizeof(defaultCaptures) / sizeof(defaultCaptures[0]));
+
+	int failed = 0;
+	for(size_t c = 0; c < captures.size(); c++)
+	{
+		int fd = open(captures[c], O_RDONLY);
+		struct stat st;
+		if(fd < 0 || fstat(fd, &st) || st.st_size < BLOCK * (HISTORY + 2) * (off_t)sizeof(float))
+		{
+			if(fd >= 0)
+				close(fd);
+			if(!defaults) // not every session has a capture.
+			{
+				printf("%s: can't be read\n", captures[c]);
+				failed++;
+			}
+			continue;
+		}
+		void* data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if(data == MAP_FAILED)
+		{
+			failed++;
+			continue;
+		}
+		size_t length = st.st_size / sizeof(float);
+
+		struct timespec start;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		std::vector<double> onsets = detect((const float*)data, length, threads);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		munmap(data, st.st_size);
+
+		const char* name = strrchr(captures[c], '/');
+		name = name ? name + 1 : captures[c];
+		std::string directory = out ? out : name == captures[c] ? "." : std::string(captures[c], name - 1 - captures[c]);
+		std::string path = directory + "/" + name + "_Onsets.txt";
+		if(!writeOnsets(path, onsets))
+		{
+			printf("%s: can't write %s\n", captures[c], path.c_str());
+			failed++;
+			continue;
+		}
+		double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+		printf("%-50s %.2f s of audio, %zu onsets in %.2f ms (%.0fx real time) -> %s\n", captures[c], length / SAMPLE_RATE,
+			onsets.size(), seconds * 1000, length / SAMPLE_RATE / seconds, path.c_str());
+		if(piezo)
+			compare(onsets, piezo);
+	}
+	return failed ? 1 : 0;
+}
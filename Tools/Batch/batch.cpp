@@ -0,0 +1,554 @@
+/*
+ Batch evaluation: every recording against every tracker configuration, on all cores, into one CSV.
+ A configuration is a name and the parameter messages that make it, the same OSC messages the laptop sends
+ (each an address, its type tags and its arguments, as for oscsend, separated by ;). They are handed to
+ render.cpp's OSC server before the replay and committed, so they are taken in the first blocks, long before
+ the first onset. A configuration file has one per line, # for comments:
+	default
+	tight		/pulse/params/tempoStdDev f 30 ; /pulse/params/syncStdDev f 30
+	threeFour	/pulse/params/meter ii 3 4
+ Messages render.cpp turns down (unknown, or out of range) are left out as they would be on the Bela, --verbose
+ shows its rt_printf to check them. Without --configs only the defaults are run.
+ The recordings are the ones given, or every sensor log under Earlier_Dev. Each is loaded once, and each job
+ (one recording with one configuration) is a forked replay (render.cpp's state is global) that shares it.
+ --jobs workers (all cores by default) each take the next job off one queue as soon as they finish the last,
+ longest recordings first, so no core is left idle behind a long one at the end. A job that crashes is reported
+ and the rest carry on.
+ Each job is scored on the Midi it sent, with the onsets found in the recording as Tools/SyncBench does:
+	lock		s from the Start to the first of LOCK_RUN onsets all within LOCK_ERROR ms of the eighth note grid
+	phase rms	ms from each onset after the lock to the nearest eighth note
+	tempo rms	bpm between the tracker and the drummer at each onset after the Start, the drummer's being the
+			tempo whose eighth note grid fits the last TEMPO_WINDOW s of onsets (see drummerBpm()), taken
+			to the octave nearest the tracker's
+	cycles		per onset: the classifier, tempoAdjust() and syncAdjust() (render.cpp's stage profiles)
+ The CSV has a row per job and then a row per configuration over all its recordings (recording "all": the
+ number that locked, mean lock time, and the rms over every onset scored), and the same summary is printed.
+ It goes to batch.csv in the current directory unless --csv says otherwise (.gitignore keeps it out of the repo).
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -I. -ITools/Host render.cpp Tools/Host/Host.cpp Tools/Host/Replay.cpp Tools/Host/SensorLog.cpp Tools/Batch/batch.cpp -o batch
+	./batch [--configs file] [--csv batch.csv] [--jobs n] [--verbose] [recording ...]
+*/
+#include "Replay.h"
+#include "StageProfiler.h"
+#include <OSCServer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <ftw.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define ONSET_THRESHOLD 0.3f // as Tools/SyncBench.
+#define RELEASE_THRESHOLD 0.05f
+#define REFRACTORY_MS 227.f
+#define LOCK_ERROR 25.f // ms
+#define LOCK_RUN 8
+#define TEMPO_WINDOW 8.0 // s of onsets the drummer's tempo is taken from...
+#define TEMPO_ONSETS 4 // ...if there are at least this many.
+#define MIN_BPM 60.0 // tempos tried for it.
+#define MAX_BPM 240.0
+#define BPM_STEP 0.25
+#define GRID_FIT 0.9
+
+extern StageHistogram tempoProfile; // render.cpp
+extern StageHistogram syncProfile;
+extern StageHistogram classifyProfile;
+
+struct Configuration
+{
+	std::string name;
+	std::vector<oscpkt::Message> messages;
+};
+
+struct BatchJob
+{
+	size_t recording;
+	size_t configuration;
+};
+
+struct BatchResult
+{
+	int ok; // 0 if the replay didn't run.
+	int onsets; // scored after the Start.
+	int started; // the tracker sent a Start.
+	float lockTime; // s from Start, -1 if it never locked.
+	double phaseSquares; // ms², over the onsets after the lock...
+	int phaseCount; // ...this many.
+	double tempoSquares; // bpm², over the onsets after the Start...
+	int tempoCount; // ...this many.
+	double cycles; // spent on the classified onsets...
+	int classified; // ...this many (bleed and all).
+	double seconds; // the replay's wall clock time.
+};
+
+static std::vector<std::string> archive;
+
+static int addLog(const char* path, const struct stat* st, int type, struct FTW* ftw)
+{
+	size_t length = strlen(path);
+	if(type == FTW_F && length > 4 && !strcmp(path + length - 4, ".txt"))
+	{
+		archive.push_back(path);
+	}
+	return 0;
+}
+
+static double secondsSince(const struct timespec& start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+// One configuration line: a name, then messages separated by ;, each "address types arguments".
+static bool parseConfiguration(const std::string& line, Configuration& c)
+{
+	std::vector<std::string> tokens;
+	size_t pos = 0;
+	while(pos < line.size())
+	{
+		if(line[pos] == ' ' || line[pos] == '\t')
+		{
+			pos++;
+			continue;
+		}
+		if(line[pos] == ';')
+		{
+			tokens.push_back(";");
+			pos++;
+			continue;
+		}
+		size_t end = line.find_first_of(" \t;", pos);
+		if(end == std::string::npos)
+			end = line.size();
+		tokens.push_back(line.substr(pos, end - pos));
+		pos = end;
+	}
+	if(tokens.empty() || tokens[0] == ";")
+		return false;
+	c.name = tokens[0];
+	c.messages.clear();
+	size_t t = 1;
+	while(t < tokens.size())
+	{
+		if(tokens[t] == ";")
+		{
+			t++;
+			continue;
+		}
+		oscpkt::Message msg(tokens[t++]);
+		std::string types = t < tokens.size() && tokens[t] != ";" && tokens[t][0] != '/' ? tokens[t++] : "";
+		for(size_t k = 0; k < types.size(); k++)
+		{
+			if(t >= tokens.size() || tokens[t] == ";" || (types[k] != 'i' && types[k] != 'f'))
+				return false;
+			if(types[k] == 'i')
+				msg.pushInt32(atoi(tokens[t++].c_str()));
+			else
+				msg.pushFloat(atof(tokens[t++].c_str()));
+		}
+		if(msg.addressPattern()[0] != '/' || (t < tokens.size() && tokens[t] != ";"))
+			return false;
+		c.messages.push_back(msg);
+	}
+	return true;
+}
+
+static bool loadConfigurations(const char* path, std::vector<Configuration>& configurations)
+{
+	FILE* file = fopen(path, "r");
+	if(!file)
+	{
+		fprintf(stderr, "Can't open %s\n", path);
+		return false;
+	}
+	char line[4096];
+	int number = 0;
+	while(fgets(line, sizeof(line), file))
+	{
+		number++;
+		std::string text(line);
+		text = text.substr(0, text.find_first_of("#\r\n"));
+		if(text.find_first_not_of(" \t") == std::string::npos)
+			continue;
+		Configuration c;
+		if(!parseConfiguration(text, c))
+		{
+			fprintf(stderr, "%s:%d: can't read the configuration\n", path, number);
+			fclose(file);
+			return false;
+		}
+		configurations.push_back(c);
+	}
+	fclose(file);
+	return true;
+}
+
+// Onset times (s) by threshold crossing with hysteresis.
+static std::vector<double> findOnsets(const Recording& recording)
+{
+	std::vector<double> onsets;
+	bool triggered = false;
+	double last = -1e9;
+	for(size_t i = 0; i < recording.values.size(); i++)
+	{
+		double t = recording.times[i];
+		if(!triggered && recording.values[i] > ONSET_THRESHOLD)
+		{
+			onsets.push_back(t);
+			triggered = true;
+			last = t;
+		}
+		else if(triggered && recording.values[i] < RELEASE_THRESHOLD && (t - last) * 1000 > REFRACTORY_MS)
+		{
+			triggered = false;
+		}
+	}
+	return onsets;
+}
+
+// The drummer's bpm at onset i, from the onsets in the TEMPO_WINDOW s up to it (0 if there aren't enough): the
+// slowest tempo whose eighth note grid the onsets fit nearly as well as the best one's, which copes with any
+// pattern of eighths. The fit is how closely their phases against the grid agree (1 = all on it).
+static double drummerBpm(const std::vector<double>& onsets, size_t i)
+{
+	size_t first = i;
+	while(first > 0 && onsets[i] - onsets[first - 1] <= TEMPO_WINDOW)
+		first--;
+	if(i - first + 1 < TEMPO_ONSETS)
+		return 0;
+	std::vector<double> fits;
+	double best = 0;
+	for(double bpm = MIN_BPM; bpm <= MAX_BPM; bpm += BPM_STEP)
+	{
+		double eighth = 30 / bpm;
+		double c = 0, s = 0;
+		for(size_t k = first; k <= i; k++)
+		{
+			double phase = 2 * M_PI * (onsets[i] - onsets[k]) / eighth;
+			c += cos(phase);
+			s += sin(phase);
+		}
+		fits.push_back(sqrt(c * c + s * s) / (i - first + 1));
+		best = std::max(best, fits.back());
+	}
+	for(size_t f = 0; f < fits.size(); f++)
+	{
+		if(fits[f] >= GRID_FIT * best)
+			return MIN_BPM + f * BPM_STEP;
+	}
+	return 0;
+}
+
+static BatchResult evaluate(const Recording& recording, const Configuration& configuration, bool verbose)
+{
+	BatchResult r = {};
+	r.lockTime = -1;
+	for(size_t m = 0; m < configuration.messages.size(); m++)
+		hostPushOscMessage(configuration.messages[m]);
+	if(!configuration.messages.empty())
+		hostPushOscMessage(oscpkt::Message("/pulse/params/commit"));
+	ReplayOptions options;
+	options.verbose = verbose;
+	ReplayResult result;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if(!runReplay(recording, options, result))
+		return r;
+	r.seconds = secondsSince(start);
+	r.ok = 1;
+	r.cycles = classifyProfile.total + tempoProfile.total + syncProfile.total;
+	r.classified = classifyProfile.count;
+
+	// Eighth note grid from the Midi, counted from the last Start.
+	std::vector<double> grid;
+	double startTime = -1;
+	int pulses = 0;
+	for(size_t i = 0; i < result.midi.size(); i++)
+	{
+		double t = result.midi[i].sample / options.audioSampleRate;
+		if(result.midi[i].byte == 250)
+		{
+			startTime = t;
+			pulses = 0;
+			grid.clear();
+		}
+		else if(result.midi[i].byte == 248 && startTime >= 0)
+		{
+			if(pulses % 12 == 0)
+				grid.push_back(t);
+			pulses++;
+		}
+	}
+	r.started = startTime >= 0;
+	if(grid.size() < 2)
+		return r;
+
+	std::vector<double> onsets = findOnsets(recording);
+	std::vector<double> errors;
+	std::vector<double> errorTimes;
+	size_t g = 0;
+	size_t b = 0;
+	for(size_t i = 0; i < onsets.size(); i++)
+	{
+		if(onsets[i] < grid.front() || onsets[i] > grid.back())
+			continue;
+		while(g + 1 < grid.size() && grid[g + 1] <= onsets[i])
+			g++;
+		double before = onsets[i] - grid[g];
+		double after = g + 1 < grid.size() ? grid[g + 1] - onsets[i] : 1e9;
+		errors.push_back(before < after ? before * 1000 : -after * 1000);
+		errorTimes.push_back(onsets[i]);
+
+		double drummer = drummerBpm(onsets, i);
+		while(b + 1 < result.bpm.size() && result.bpm[b + 1].sample / options.audioSampleRate <= onsets[i])
+			b++;
+		double tracker = result.bpm[b].bpm;
+		if(drummer > 0)
+		{
+			while(drummer * M_SQRT2 < tracker)
+				drummer *= 2;
+			while(drummer / M_SQRT2 > tracker)
+				drummer /= 2;
+			r.tempoSquares += (tracker - drummer) * (tracker - drummer);
+			r.tempoCount++;
+		}
+	}
+	r.onsets = errors.size();
+	for(size_t i = 0; i + LOCK_RUN <= errors.size(); i++)
+	{
+		bool run = true;
+		for(size_t k = i; k < i + LOCK_RUN && run; k++)
+			run = fabs(errors[k]) < LOCK_ERROR;
+		if(run)
+		{
+			r.lockTime = errorTimes[i] - startTime;
+			for(size_t k = i; k < errors.size(); k++)
+				r.phaseSquares += errors[k] * errors[k];
+			r.phaseCount = errors.size() - i;
+			break;
+		}
+	}
+	return r;
+}
+
+static void csvNumber(FILE* csv, double value, bool have)
+{
+	if(have)
+		fprintf(csv, ",%.3f", value);
+	else
+		fprintf(csv, ",");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* configPath = 0;
+	const char* csvPath = "batch.csv";
+	int jobs = std::max(1u, std::thread::hardware_concurrency());
+	bool verbose = false;
+	std::vector<std::string> paths;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--configs") && i + 1 < argc)
+			configPath = argv[++i];
+		else if(!strcmp(argv[i], "--csv") && i + 1 < argc)
+			csvPath = argv[++i];
+		else if(!strcmp(argv[i], "--jobs") && i + 1 < argc)
+			jobs = std::max(1, atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--verbose"))
+			verbose = true;
+		else if(argv[i][0] == '-')
+		{
+			printf("Usage: %s [--configs file] [--csv batch.csv] [--jobs n] [--verbose] [recording ...]\n", argv[0]);
+			return 2;
+		}
+		else
+			paths.push_back(argv[i]);
+	}
+
+	std::vector<Configuration> configurations;
+	if(configPath && !loadConfigurations(configPath, configurations))
+		return 2;
+	if(configurations.empty())
+	{
+		configurations.resize(1);
+		configurations[0].name = "default";
+	}
+	if(paths.empty())
+	{
+		nftw("Earlier_Dev", addLog, 16, FTW_PHYS);
+		std::sort(archive.begin(), archive.end());
+		paths = archive;
+	}
+
+	// Loaded once here, and shared with every job's process by fork().
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	std::vector<Recording> recordings;
+	std::vector<std::string> names;
+	for(size_t i = 0; i < paths.size(); i++)
+	{
+		Recording recording;
+		if(loadRecording(paths[i].c_str(), recording) && recording.times.size() > 1)
+		{
+			recordings.push_back(recording);
+			names.push_back(paths[i]);
+		}
+		else
+			fprintf(stderr, "%s isn't a sensor log, left out\n", paths[i].c_str());
+	}
+	if(recordings.empty())
+		return 2;
+	double loadSeconds = secondsSince(start);
+
+	std::vector<BatchJob> queue;
+	for(size_t r = 0; r < recordings.size(); r++)
+	{
+		for(size_t c = 0; c < configurations.size(); c++)
+		{
+			BatchJob job = {r, c};
+			queue.push_back(job);
+		}
+	}
+	std::vector<size_t> order(queue.size()); // longest recordings first.
+	for(size_t j = 0; j < order.size(); j++)
+		order[j] = j;
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return recordings[queue[a].recording].times.back() > recordings[queue[b].recording].times.back();
+	});
+
+	// Each child writes its BatchResult down a pipe and exits.
+	std::vector<BatchResult> results(queue.size());
+	std::vector<int> status(queue.size(), -1); // -1 not run, 0 ok, 1 crashed.
+	std::map<pid_t, std::pair<size_t, int> > running; // pid -> job, read end of its pipe.
+	size_t next = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while(next < order.size() || !running.empty())
+	{
+		while(next < order.size() && (int)running.size() < jobs)
+		{
+			size_t j = order[next++];
+			int fds[2];
+			if(pipe(fds))
+				return 1;
+			fflush(stdout);
+			pid_t pid = fork();
+			if(pid == 0)
+			{
+				close(fds[0]);
+				BatchResult r = evaluate(recordings[queue[j].recording], configurations[queue[j].configuration], verbose);
+				fflush(stdout);
+				ssize_t written = write(fds[1], &r, sizeof(r));
+				_exit(written == sizeof(r) ? 0 : 1);
+			}
+			close(fds[1]);
+			if(pid < 0)
+			{
+				close(fds[0]);
+				return 1;
+			}
+			running[pid] = std::make_pair(j, fds[0]);
+		}
+		int childStatus;
+		pid_t pid = wait(&childStatus);
+		if(pid < 0)
+			break;
+		std::map<pid_t, std::pair<size_t, int> >::iterator child = running.find(pid);
+		if(child == running.end())
+			continue;
+		size_t j = child->second.first;
+		BatchResult r;
+		bool read = ::read(child->second.second, &r, sizeof(r)) == sizeof(r);
+		close(child->second.second);
+		running.erase(child);
+		if(read && WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0 && r.ok)
+		{
+			results[j] = r;
+			status[j] = 0;
+		}
+		else
+			status[j] = 1;
+	}
+	double seconds = secondsSince(start);
+
+	FILE* csv = fopen(csvPath, "w");
+	if(!csv)
+	{
+		fprintf(stderr, "Can't write %s\n", csvPath);
+		return 1;
+	}
+	fprintf(csv, "recording,configuration,status,onsets,locked,lock_s,phase_rms_ms,tempo_rms_bpm,cycles_per_onset,replay_s\n");
+	for(size_t j = 0; j < queue.size(); j++)
+	{
+		const BatchResult& r = results[j];
+		fprintf(csv, "\"%s\",%s,%s", names[queue[j].recording].c_str(), configurations[queue[j].configuration].name.c_str(),
+			status[j] ? "crashed" : !r.started ? "no start" : "ok");
+		if(status[j])
+		{
+			fprintf(csv, ",,,,,,,\n");
+			continue;
+		}
+		fprintf(csv, ",%d,%d", r.onsets, r.lockTime >= 0);
+		csvNumber(csv, r.lockTime, r.lockTime >= 0);
+		csvNumber(csv, r.phaseCount ? sqrt(r.phaseSquares / r.phaseCount) : 0, r.phaseCount > 0);
+		csvNumber(csv, r.tempoCount ? sqrt(r.tempoSquares / r.tempoCount) : 0, r.tempoCount > 0);
+		csvNumber(csv, r.classified ? r.cycles / r.classified : 0, r.classified > 0);
+		fprintf(csv, ",%.3f\n", r.seconds);
+	}
+
+	printf("%-16s %8s %8s %10s %12s %12s %12s %8s\n", "configuration", "locked", "crashed", "mean lock", "phase rms", "tempo rms",
+		PROFILE_UNITS "/onset", "onsets");
+	for(size_t c = 0; c < configurations.size(); c++)
+	{
+		int locked = 0, crashed = 0, onsets = 0, phaseCount = 0, tempoCount = 0, classified = 0;
+		double lockSum = 0, phaseSquares = 0, tempoSquares = 0, cycles = 0;
+		int runs = 0;
+		for(size_t j = 0; j < queue.size(); j++)
+		{
+			if(queue[j].configuration != c)
+				continue;
+			const BatchResult& r = results[j];
+			runs++;
+			if(status[j])
+			{
+				crashed++;
+				continue;
+			}
+			onsets += r.onsets;
+			if(r.lockTime >= 0)
+			{
+				locked++;
+				lockSum += r.lockTime;
+			}
+			phaseSquares += r.phaseSquares;
+			phaseCount += r.phaseCount;
+			tempoSquares += r.tempoSquares;
+			tempoCount += r.tempoCount;
+			cycles += r.cycles;
+			classified += r.classified;
+		}
+		double phaseRms = phaseCount ? sqrt(phaseSquares / phaseCount) : 0;
+		double tempoRms = tempoCount ? sqrt(tempoSquares / tempoCount) : 0;
+		double cyclesPerOnset = classified ? cycles / classified : 0;
+		fprintf(csv, "all,%s,%d crashed,%d,%d", configurations[c].name.c_str(), crashed, onsets, locked);
+		csvNumber(csv, locked ? lockSum / locked : 0, locked > 0);
+		csvNumber(csv, phaseRms, phaseCount > 0);
+		csvNumber(csv, tempoRms, tempoCount > 0);
+		csvNumber(csv, cyclesPerOnset, classified > 0);
+		fprintf(csv, ",\n");
+		printf("%-16s %4d/%-3d %8d %8.2f s %9.2f ms %8.2f bpm %12.0f %8d\n", configurations[c].name.c_str(), locked, runs,
+			crashed, locked ? lockSum / locked : 0.0, phaseRms, tempoRms, cyclesPerOnset, onsets);
+	}
+	fclose(csv);
+	printf("%zu jobs (%zu recordings, %zu configurations) in %.2f s on %d jobs, loading took %.2f s. Written to %s\n",
+		queue.size(), recordings.size(), configurations.size(), seconds, jobs, loadSeconds, csvPath);
+	return 0;
+}
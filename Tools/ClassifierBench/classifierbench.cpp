@@ -0,0 +1,168 @@
+/*
+ Onset classifier benchmark: what OnsetClassifier.h labels each onset in the recordings, and what it costs.
+ The recording is sampled and held at the analog rate (22.05 kHz) as Tools/Host/Replay.cpp does, and the onsets
+ are found and classified as render() does: defaultParams' thresholds, the RETRIGGER_MS holdoff (dropped after
+ bleed), the classifier's parameters from setClassifierParams() and the time since the last kick's crossing.
+ Every onset is run REPEATS times, with StageProfiler.h's counter read around each whole window
+ (startOnset() and every feedOnset()) and around the classifyOnset() after it (less the cost of reading the
+ counter, which would swamp a single feedOnset()), which gives:
+	window		the 99.9th percentile and worst, and the 99.9th percentile spread over the window's samples
+	decision	the 99.9th percentile and worst
+	budget		window + decision at their 99.9th percentiles, the bound to plan around
+ The classifier does the same work whatever the signal is, so the budget holds for any onset. The worst
+ readings are usually the process being interrupted, which is why the budget is built from percentiles.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -I. -ITools/Host render.cpp Tools/Host/Host.cpp Tools/Host/Replay.cpp Tools/Host/SensorLog.cpp Tools/ClassifierBench/classifierbench.cpp -o classifierbench
+	./classifierbench [recording ...]
+*/
+#include "Replay.h"
+#include "TrackerParams.h"
+#include "StageProfiler.h"
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#define ANALOG_RATE 22050.f
+#define REPEATS 200
+
+const char* defaultRecordings[] = {
+	"Earlier_Dev/Comparison_Test/Piezo(Comparison_Study).txt",
+	"Earlier_Dev/Sensors-_OSC/C1a_PiezoCSV.txt",
+};
+
+static std::vector<float> sampleAndHold(const Recording& recording)
+{
+	std::vector<float> samples;
+	size_t index = 0;
+	for(size_t n = 0; n / ANALOG_RATE < recording.times.back(); n++)
+	{
+		while(index + 1 < recording.times.size() && recording.times[index + 1] <= n / ANALOG_RATE)
+		{
+			index++;
+		}
+		samples.push_back(recording.values[index]);
+	}
+	return samples;
+}
+
+static uint32_t counterOverhead()
+{
+	uint32_t best = ~0u;
+	for(int i = 0; i < 1000; i++)
+	{
+		uint32_t start = readCycleCounter();
+		best = std::min(best, readCycleCounter() - start);
+	}
+	return best;
+}
+
+static uint32_t timed(uint32_t start, uint32_t overhead)
+{
+	uint32_t cycles = readCycleCounter() - start;
+	return cycles > overhead ? cycles - overhead : 0;
+}
+
+// Sorts the readings.
+static uint32_t percentile(std::vector<uint32_t>& readings)
+{
+	std::sort(readings.begin(), readings.end());
+	return readings[readings.size() * 999 / 1000];
+}
+
+// Classifies the onset crossing at samples[n] as render() does, timing the window and the decision REPEATS
+// times. Returns the sample the decision was made on.
+static size_t classify(OnsetClassifier& c, const OnsetClassifierParams& p, const std::vector<float>& samples, size_t n,
+	float sinceKick, uint32_t overhead, std::vector<uint32_t>& perWindow, std::vector<uint32_t>& perDecision, OnsetClass& label)
+{
+	float lastKickPeak = c.lastKickPeak;
+	size_t m = n;
+	for(int r = 0; r < REPEATS; r++)
+	{
+		c.lastKickPeak = lastKickPeak;
+		m = n;
+		uint32_t start = readCycleCounter();
+		bool full = startOnset(c, p, samples[m]);
+		while(!full && ++m < samples.size())
+			full = feedOnset(c, p, samples[m]);
+		perWindow.push_back(timed(start, overhead));
+		start = readCycleCounter();
+		label = classifyOnset(c, p, sinceKick);
+		perDecision.push_back(timed(start, overhead));
+	}
+	return m;
+}
+
+static void bench(const char* path, uint32_t overhead)
+{
+	Recording recording;
+	if(!loadRecording(path, recording))
+		return;
+	std::vector<float> samples = sampleAndHold(recording);
+
+	OnsetClassifierParams p;
+	setClassifierParams(p, defaultParams, ANALOG_RATE);
+	size_t retriggerFrames = RETRIGGER_MS * ANALOG_RATE / 1000;
+
+	// Find the onsets the way render() does: the crossing, then the retrigger holdoff (dropped after bleed)
+	// and the release threshold.
+	int counts[3] = {0, 0, 0};
+	std::vector<uint32_t> perWindow;
+	std::vector<uint32_t> perDecision;
+	OnsetClassifier c = {};
+	size_t lastKick = 0;
+	bool haveKick = false;
+	bool trig = false;
+	size_t retriggerFrame = 0;
+	for(size_t n = 0; n < samples.size(); n++)
+	{
+		if(!trig && samples[n] > defaultParams.onsetThreshold)
+		{
+			trig = true;
+			retriggerFrame = n + retriggerFrames;
+			float sinceKick = haveKick ? n - lastKick : 1e9; // since the last kick's crossing, as render.cpp's lastKickTime.
+			OnsetClass label;
+			size_t decided = classify(c, p, samples, n, sinceKick, overhead, perWindow, perDecision, label);
+			counts[label]++;
+			if(label == ONSET_KICK)
+			{
+				lastKick = n;
+				haveKick = true;
+			}
+			else
+			{
+				printf("	%8.3f s  %-5s  peak %.3f  rise %.2f ms  decay %.2f\n", n / ANALOG_RATE, onsetClassNames[label],
+					c.features.peak, c.features.rise * 1000 / ANALOG_RATE, c.features.decay);
+			}
+			if(label == ONSET_BLEED) // render() can release from the sample the bleed is found on.
+				retriggerFrame = decided > 0 ? decided - 1 : 0;
+		}
+		if(trig && samples[n] < defaultParams.releaseThreshold && n > retriggerFrame)
+			trig = false;
+	}
+
+	printf("%-60s onsets %4d	kick %d	ghost %d	bleed %d\n", path, counts[0] + counts[1] + counts[2],
+		counts[ONSET_KICK], counts[ONSET_GHOST], counts[ONSET_BLEED]);
+	if(perWindow.empty())
+		return;
+	uint32_t window = percentile(perWindow);
+	uint32_t decision = percentile(perDecision);
+	printf("	window p99.9 %u worst %u (%.1f per sample)	decision p99.9 %u worst %u	budget %u (%s, window %d samples)\n",
+		window, perWindow.back(), (float)window / p.window, decision, perDecision.back(), window + decision, PROFILE_UNITS, p.window);
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<const char*> paths;
+	for(int i = 1; i < argc; i++)
+		paths.push_back(argv[i]);
+	if(paths.empty())
+		paths.assign(defaultRecordings, defaultRecordings + sizeof(defaultRecordings) / sizeof(defaultRecordings[0]));
+
+	uint32_t overhead = counterOverhead();
+	for(size_t i = 0; i < paths.size(); i++)
+	{
+		bench(paths[i], overhead);
+	}
+	return 0;
+}
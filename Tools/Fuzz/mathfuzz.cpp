@@ -0,0 +1,177 @@
+/*
+ Adversarial onset sequences straight into the tracker math: syncAdjust() and tempoAdjust(), as render() calls
+ them for each onset in TRACK_MODE, after setup() has run through a short silent replay (which also sets
+ flush-to-zero on this thread, see FlushToZero.h). Each pattern runs in its own process from a fresh tracker:
+	even		onsets exactly a quarter note apart, so every performance error is zero
+	identical	the same time over and over (zero IOIs)
+	tiny		0.001 ms apart
+	huge		17 minutes apart
+	random		anywhere from 1 ms to 2 s apart
+	alternating	50 ms then 3 s
+	late		hours into the session, where a float time in ms only has 64 ms steps
+	bursts		a steady beat with every other onset thrown far out, so the gaussian tails underflow
+ For each pattern the cost of every onset is timed with StageProfiler.h's counter (median, 99th percentile and
+ worst should be about the same from pattern to pattern) and the tracker state is checked after every onset.
+ The first onset that left any of it infinite or NaN is reported.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -I. -ITools/Host render.cpp Tools/Host/Host.cpp Tools/Host/Replay.cpp Tools/Host/SensorLog.cpp Tools/Fuzz/mathfuzz.cpp -o mathfuzz
+	./mathfuzz [--onsets 10000]
+ To see what the guards are worth, build it the same way from an earlier render.cpp ("git show <revision>:render.cpp").
+*/
+#include "Replay.h"
+#include "StageProfiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define MAX_ONSETS 8 // render.cpp's
+
+// Tracker state (render.cpp).
+extern float onsets[MAX_ONSETS];
+extern int onsetInd;
+extern float now;
+extern float bpm;
+extern float eightNote;
+extern float tempoThreshold;
+extern float tempoStdDev;
+extern float syncStdDev;
+extern float syncDelta;
+extern float filteredPhaseError;
+extern float mostRecentMidiClickTime;
+extern float pulseTarget;
+void syncAdjust();
+void tempoAdjust();
+
+const char* patterns[] = {"even", "identical", "tiny", "huge", "random", "alternating", "late", "bursts"};
+const int numPatterns = sizeof(patterns) / sizeof(patterns[0]);
+
+static uint64_t rngState = 0x9E3779B97F4A7C15ull;
+
+static double uniform()
+{
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+	return ((rngState * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Time of onset i (ms).
+static double onsetTime(int pattern, int i, double last)
+{
+	switch(pattern)
+	{
+		case 0: return last + 2 * eightNote;
+		case 1: return 1000;
+		case 2: return last + 0.001;
+		case 3: return last + 1e6;
+		case 4: return last + 1 + uniform() * 1999;
+		case 5: return last + (i % 2 ? 3000 : 50);
+		case 6: return 3.6e7 + i * 500.0;
+		default: return i % 2 ? last + 500 : last + 500 + 1e5 * uniform();
+	}
+}
+
+static bool stateFinite()
+{
+	float state[] = {bpm, eightNote, tempoThreshold, tempoStdDev, syncStdDev, syncDelta, filteredPhaseError,
+		mostRecentMidiClickTime, pulseTarget};
+	for(size_t i = 0; i < sizeof(state) / sizeof(state[0]); i++)
+	{
+		if(!std::isfinite(state[i]))
+			return false;
+	}
+	return true;
+}
+
+static int run(int pattern, int count)
+{
+	// setup() and a few blocks of silence, to leave the tracker as it is before the first onset.
+	Recording silence;
+	silence.times.push_back(0);
+	silence.values.push_back(0);
+	silence.times.push_back(0.01f);
+	silence.values.push_back(0);
+	ReplayOptions options;
+	ReplayResult result;
+	if(!runReplay(silence, options, result))
+		return 2;
+
+	uint32_t overhead = ~0u;
+	for(int i = 0; i < 1000; i++)
+	{
+		uint32_t start = readCycleCounter();
+		overhead = std::min(overhead, readCycleCounter() - start);
+	}
+
+	std::vector<uint32_t> costs;
+	costs.reserve(count);
+	int firstBad = -1;
+	double last = 0;
+	for(int i = 0; i < count; i++)
+	{
+		last = onsetTime(pattern, i, last);
+		now = last;
+		onsets[onsetInd] = now;
+		onsetInd = (onsetInd + 1) % MAX_ONSETS;
+		uint32_t start = readCycleCounter();
+		syncAdjust();
+		tempoAdjust();
+		uint32_t cycles = readCycleCounter() - start;
+		costs.push_back(cycles > overhead ? cycles - overhead : 0);
+		if(firstBad < 0 && !stateFinite())
+			firstBad = i;
+	}
+	std::sort(costs.begin(), costs.end());
+	printf("%-12s p50 %7u  p99 %7u  worst %8u %s   bpm %8.2f  tempoStdDev %8.2f   ", patterns[pattern], costs[costs.size() / 2],
+		costs[costs.size() * 99 / 100], costs.back(), PROFILE_UNITS, bpm, tempoStdDev);
+	if(firstBad >= 0)
+		printf("NOT FINITE from onset %d\n", firstBad);
+	else
+		printf("finite\n");
+	return firstBad >= 0;
+}
+
+int main(int argc, char* argv[])
+{
+	int count = 10000;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--onsets") && i + 1 < argc)
+			count = std::max(1, atoi(argv[++i]));
+		else
+		{
+			printf("Usage: %s [--onsets n]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	// One process per pattern (render.cpp's state is global), one after another so the output stays in order.
+	int failed = 0;
+	for(int p = 0; p < numPatterns; p++)
+	{
+		fflush(stdout);
+		pid_t pid = fork();
+		if(pid == 0)
+		{
+			int status = run(p, count);
+			fflush(stdout);
+			_exit(status);
+		}
+		int status = 2;
+		if(pid > 0)
+			waitpid(pid, &status, 0);
+		if(!(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+		{
+			if(!WIFEXITED(status))
+				printf("%-12s CRASHED\n", patterns[p]);
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,345 @@
+/*
+ Tracker fuzzing with synthetic drummers (Tools/Host/Performance.h).
+ For every tempo from --from to --to bpm (every --step) and every seed, a humanised performance is generated
+ from a tempo map in the style of Comparison_Test's click track and replayed through render.cpp in TRACK_MODE:
+	bars  0-7	steady
+	bars  8-15	speeding up by about 10%
+	bars 16-19	half time
+	bars 20-23	double time
+	bars 24-27	slowing back down
+	bars 28-31	steady
+ and scored on the Midi it sent: lock time and RMS phase error against the eighth note grid (as
+ Tools/SyncBench does, but against the hits the generator placed), and the tracker's bpm at the end against
+ the map's, counting a tracker that settled on half or double the tempo as an octave error.
+ Each replay is its own process (render.cpp's state is global), --jobs of them at a time (all cores by default).
+ A replay that crashes is reported with its tempo and seed so it can be run again on its own.
+ --bench only times the generator, on every core.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -I. -ITools/Host render.cpp Tools/Host/Host.cpp Tools/Host/Replay.cpp Tools/Host/SensorLog.cpp Tools/Host/Performance.cpp Tools/Fuzz/trackerfuzz.cpp -o trackerfuzz
+	./trackerfuzz [--from 60] [--to 240] [--step 5] [--seeds 1] [--seed 1] [--jobs n]
+	./trackerfuzz --bench [--hits 100000000]
+*/
+#include "Replay.h"
+#include "Performance.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <map>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PIEZO_RATE 4000.f // Hz, the recorded logs are 1 kHz.
+#define PIEZO_DECAY 15.f // ms
+#define PIEZO_NOISE 0.02f
+#define LOCK_ERROR 25.f // ms, as Tools/SyncBench.
+#define LOCK_RUN 8
+#define BPM_TOLERANCE 0.03f // fraction of the map's bpm the tracker has to end within.
+
+const Humanize defaultHumanize = {
+	8.f, // jitterMs
+	2.f, // driftMs
+	20.f, // driftLimitMs
+	0.1f, // fillRate
+	0.03f, // missRate
+	0.05f, // extraRate
+	1 // seed
+};
+
+struct FuzzJob
+{
+	float bpm;
+	uint64_t seed;
+};
+
+struct FuzzResult
+{
+	int ok; // 0 if the replay didn't run.
+	float lockTime; // s from Start, -1 if it never locked.
+	float rms; // ms, once locked.
+	float endBpm;
+	float mapBpm;
+	int octave; // 0, or the tracker ended on half (-1) or double (1) the tempo.
+};
+
+static TempoMap fuzzMap(float bpm)
+{
+	TempoMap map;
+	map.startBpm = bpm;
+	map.beatsPerBar = 4;
+	map.bars = 32;
+	TempoCheckpoint sections[] = {
+		{0, 0.f, FEEL_STRAIGHT},
+		{8, bpm * 0.003f, FEEL_STRAIGHT},
+		{16, 0.f, FEEL_HALF},
+		{20, 0.f, FEEL_DOUBLE},
+		{24, -bpm * 0.006f, FEEL_STRAIGHT},
+		{28, 0.f, FEEL_STRAIGHT},
+	};
+	map.checkpoints.assign(sections, sections + sizeof(sections) / sizeof(sections[0]));
+	return map;
+}
+
+static FuzzResult fuzz(const FuzzJob& job)
+{
+	FuzzResult r = {0, -1, 0, 0, 0, 0};
+	Humanize humanize = defaultHumanize;
+	humanize.seed = job.seed;
+	std::vector<Hit> hits;
+	generatePerformance(fuzzMap(job.bpm), humanize, hits);
+	Recording recording;
+	renderPiezo(hits, PIEZO_RATE, PIEZO_DECAY, PIEZO_NOISE, job.seed, recording);
+	ReplayOptions options;
+	ReplayResult result;
+	if(hits.empty() || !runReplay(recording, options, result))
+		return r;
+	r.ok = 1;
+	r.mapBpm = hits.back().bpm;
+	r.endBpm = result.bpm.back().bpm;
+	float ratio = r.endBpm / r.mapBpm;
+	if(fabs(ratio - 0.5f) < BPM_TOLERANCE)
+		r.octave = -1;
+	else if(fabs(ratio - 2.f) < 2 * BPM_TOLERANCE)
+		r.octave = 1;
+
+	// Eighth note grid from the Midi, counted from the last Start.
+	std::vector<double> grid;
+	double start = -1;
+	int pulses = 0;
+	for(size_t i = 0; i < result.midi.size(); i++)
+	{
+		double t = result.midi[i].sample / options.audioSampleRate;
+		if(result.midi[i].byte == 250)
+		{
+			start = t;
+			pulses = 0;
+			grid.clear();
+		}
+		else if(result.midi[i].byte == 248 && start >= 0)
+		{
+			if(pulses % 12 == 0)
+				grid.push_back(t);
+			pulses++;
+		}
+	}
+	if(grid.size() < 2)
+		return r;
+
+	std::vector<double> errors;
+	std::vector<double> errorTimes;
+	size_t g = 0;
+	for(size_t i = 0; i < hits.size(); i++)
+	{
+		if(hits[i].velocity < 0.7f || hits[i].time < grid.front() || hits[i].time > grid.back())
+			continue; // only the kicks, not the fills and ghost notes.
+		while(g + 1 < grid.size() && grid[g + 1] <= hits[i].time)
+			g++;
+		double before = hits[i].time - grid[g];
+		double after = g + 1 < grid.size() ? grid[g + 1] - hits[i].time : 1e9;
+		errors.push_back(before < after ? before * 1000 : -after * 1000);
+		errorTimes.push_back(hits[i].time);
+	}
+	for(size_t i = 0; i + LOCK_RUN <= errors.size(); i++)
+	{
+		bool run = true;
+		for(size_t k = i; k < i + LOCK_RUN && run; k++)
+			run = fabs(errors[k]) < LOCK_ERROR;
+		if(run)
+		{
+			r.lockTime = errorTimes[i] - start;
+			double sum = 0;
+			for(size_t k = i; k < errors.size(); k++)
+				sum += errors[k] * errors[k];
+			r.rms = sqrt(sum / (errors.size() - i));
+			break;
+		}
+	}
+	return r;
+}
+
+static double secondsSince(const struct timespec& start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+static void generateHits(uint64_t seed, size_t total, double* checksum)
+{
+	TempoMap map = fuzzMap(120);
+	map.bars = total; // ends on the count below long before this.
+	Humanize humanize = defaultHumanize;
+	humanize.seed = seed;
+	PerformanceGenerator generator(map, humanize);
+	Hit batch[4096];
+	size_t made = 0;
+	double sum = 0;
+	while(made < total)
+	{
+		size_t count = generator.next(batch, 4096);
+		if(!count)
+			break;
+		for(size_t i = 0; i < count; i++)
+			sum += batch[i].time;
+		made += count;
+	}
+	*checksum = sum;
+}
+
+static int bench(size_t hits)
+{
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> workers;
+	std::vector<double> checksums(threads);
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int t = 0; t < threads; t++)
+		workers.push_back(std::thread(generateHits, t + 1, hits / threads, &checksums[t]));
+	for(int t = 0; t < threads; t++)
+		workers[t].join();
+	double seconds = secondsSince(start);
+	printf("%zu hits on %d threads in %.3f s: %.1f million hits/s (checksum %g)\n", hits, threads, seconds,
+		hits / seconds / 1e6, checksums[0]);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	float from = 60;
+	float to = 240;
+	float step = 5;
+	int seeds = 1;
+	uint64_t firstSeed = 1;
+	int jobs = std::max(1u, std::thread::hardware_concurrency());
+	bool benchOnly = false;
+	size_t benchHits = 100000000;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--from") && i + 1 < argc)
+			from = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--to") && i + 1 < argc)
+			to = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--step") && i + 1 < argc)
+			step = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--seeds") && i + 1 < argc)
+			seeds = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--seed") && i + 1 < argc)
+			firstSeed = strtoull(argv[++i], 0, 10);
+		else if(!strcmp(argv[i], "--jobs") && i + 1 < argc)
+			jobs = std::max(1, atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--bench"))
+			benchOnly = true;
+		else if(!strcmp(argv[i], "--hits") && i + 1 < argc)
+			benchHits = strtoull(argv[++i], 0, 10);
+		else
+		{
+			printf("Usage: %s [--from bpm] [--to bpm] [--step bpm] [--seeds n] [--seed first] [--jobs n] | --bench [--hits n]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(benchOnly)
+		return bench(benchHits);
+	if(step <= 0 || seeds <= 0)
+		return 2;
+
+	std::vector<FuzzJob> queue;
+	for(float bpm = from; bpm <= to + 0.001f; bpm += step)
+	{
+		for(int s = 0; s < seeds; s++)
+		{
+			FuzzJob job = {bpm, firstSeed + s};
+			queue.push_back(job);
+		}
+	}
+
+	// Each child writes its FuzzResult down a pipe and exits.
+	std::vector<FuzzResult> results(queue.size());
+	std::vector<int> status(queue.size(), -1); // -1 not run, 0 ok, 1 crashed.
+	std::map<pid_t, std::pair<size_t, int> > running; // pid -> job, read end of its pipe.
+	size_t nextJob = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while(nextJob < queue.size() || !running.empty())
+	{
+		while(nextJob < queue.size() && (int)running.size() < jobs)
+		{
+			int fds[2];
+			if(pipe(fds))
+				return 1;
+			fflush(stdout);
+			pid_t pid = fork();
+			if(pid == 0)
+			{
+				close(fds[0]);
+				FuzzResult r = fuzz(queue[nextJob]);
+				ssize_t written = write(fds[1], &r, sizeof(r));
+				_exit(written == sizeof(r) ? 0 : 1);
+			}
+			close(fds[1]);
+			if(pid < 0)
+			{
+				close(fds[0]);
+				return 1;
+			}
+			running[pid] = std::make_pair(nextJob++, fds[0]);
+		}
+		int childStatus;
+		pid_t pid = wait(&childStatus);
+		if(pid < 0)
+			break;
+		std::map<pid_t, std::pair<size_t, int> >::iterator child = running.find(pid);
+		if(child == running.end())
+			continue;
+		size_t j = child->second.first;
+		FuzzResult r;
+		bool read = ::read(child->second.second, &r, sizeof(r)) == sizeof(r);
+		close(child->second.second);
+		running.erase(child);
+		if(read && WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0)
+		{
+			results[j] = r;
+			status[j] = 0;
+		}
+		else
+			status[j] = 1;
+	}
+	double seconds = secondsSince(start);
+
+	int locked = 0;
+	int onTempo = 0;
+	int octaves = 0;
+	int crashed = 0;
+	double lockSum = 0;
+	printf("   bpm  seed     lock      rms     end bpm    map bpm\n");
+	for(size_t j = 0; j < queue.size(); j++)
+	{
+		printf("%6.1f  %4llu  ", queue[j].bpm, (unsigned long long)queue[j].seed);
+		if(status[j] != 0 || !results[j].ok)
+		{
+			printf("CRASHED (run again with --from %g --to %g --seed %llu --seeds 1)\n", queue[j].bpm, queue[j].bpm,
+				(unsigned long long)queue[j].seed);
+			crashed++;
+			continue;
+		}
+		const FuzzResult& r = results[j];
+		if(r.lockTime >= 0)
+		{
+			printf("%6.2f s  %5.1f ms", r.lockTime, r.rms);
+			locked++;
+			lockSum += r.lockTime;
+		}
+		else
+			printf("   never          ");
+		bool within = fabs(r.endBpm - r.mapBpm) < BPM_TOLERANCE * r.mapBpm;
+		onTempo += within;
+		octaves += r.octave != 0;
+		printf("  %8.2f   %8.2f  %s\n", r.endBpm, r.mapBpm, within ? "" : r.octave < 0 ? "HALF" : r.octave > 0 ? "DOUBLE" : "OFF");
+	}
+	printf("%zu runs in %.1f s on %d jobs: %d locked (mean %.2f s), %d ended on tempo, %d octave errors, %d crashed\n",
+		queue.size(), seconds, jobs, locked, locked ? lockSum / locked : 0.0, onTempo, octaves, crashed);
+	return crashed ? 1 : 0;
+}
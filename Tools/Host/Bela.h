@@ -0,0 +1,107 @@
+/*
+ Host stand-in for the parts of Bela.h that render.cpp uses, so the project can be built and
+ replayed on a workstation (see Replay.h). Only what the Pulse needs is here.
+*/
+#ifndef HOST_BELA_H
+#define HOST_BELA_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <rtdk.h>
+
+typedef struct {
+	float *audioIn;
+	float *audioOut;
+	float *analogIn;
+	float *analogOut;
+	uint32_t *digital; // bits 0-15 are the pin directions, 16-31 the pin values (as on the Bela).
+
+	unsigned int audioFrames;
+	unsigned int audioInChannels;
+	unsigned int audioOutChannels;
+	float audioSampleRate;
+
+	unsigned int analogFrames;
+	unsigned int analogInChannels;
+	unsigned int analogOutChannels;
+	float analogSampleRate;
+
+	unsigned int digitalFrames;
+	unsigned int digitalChannels;
+	float digitalSampleRate;
+
+	uint64_t audioFramesElapsed;
+	uint32_t flags;
+} BelaContext;
+
+enum { GPIO_LOW = 0, GPIO_HIGH = 1 };
+enum { INPUT = 0, OUTPUT = 1 };
+enum { P8_07 = 0, P8_08, P8_09, P8_10, P8_11, P8_12, P9_12, P9_14, P8_15, P8_16, P9_16, P8_18, P8_27, P8_28, P8_29, P8_30 };
+
+static inline float analogRead(BelaContext *context, int frame, int channel)
+{
+	return context->analogIn[frame * context->analogInChannels + channel];
+}
+
+static inline void analogWrite(BelaContext *context, int frame, int channel, float value)
+{
+	context->analogOut[frame * context->analogOutChannels + channel] = value;
+}
+
+static inline float audioRead(BelaContext *context, int frame, int channel)
+{
+	return context->audioIn[frame * context->audioInChannels + channel];
+}
+
+static inline void audioWrite(BelaContext *context, int frame, int channel, float value)
+{
+	context->audioOut[frame * context->audioOutChannels + channel] = value;
+}
+
+static inline int digitalRead(BelaContext *context, int frame, int channel)
+{
+	return (context->digital[frame] >> (16 + channel)) & 1;
+}
+
+// Like the Bela, a write holds from this frame to the end of the block.
+static inline void digitalWrite(BelaContext *context, int frame, int channel, int value)
+{
+	for(unsigned int f = frame; f < context->digitalFrames; f++)
+	{
+		if(value)
+			context->digital[f] |= 1u << (16 + channel);
+		else
+			context->digital[f] &= ~(1u << (16 + channel));
+	}
+}
+
+static inline void digitalWriteOnce(BelaContext *context, int frame, int channel, int value)
+{
+	if(value)
+		context->digital[frame] |= 1u << (16 + channel);
+	else
+		context->digital[frame] &= ~(1u << (16 + channel));
+}
+
+static inline void pinMode(BelaContext *context, int frame, int channel, int mode)
+{
+	for(unsigned int f = frame; f < context->digitalFrames; f++)
+	{
+		if(mode == INPUT)
+			context->digital[f] |= 1u << channel;
+		else
+			context->digital[f] &= ~(1u << channel);
+	}
+}
+
+// Aux tasks run straight away on the calling thread, which keeps a replay deterministic.
+typedef void* AuxiliaryTask;
+AuxiliaryTask Bela_createAuxiliaryTask(void (*functionToCall)(), int priority, const char *name);
+int Bela_scheduleAuxiliaryTask(AuxiliaryTask task);
+
+// Implemented by the project (render.cpp).
+bool setup(BelaContext *context, void *userData);
+void render(BelaContext *context, void *userData);
+void cleanup(BelaContext *context, void *userData);
+
+#endif /* HOST_BELA_H */
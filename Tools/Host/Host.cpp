@@ -0,0 +1,35 @@
+/*
+ Host implementations behind the stand-in Bela headers.
+*/
+#include <Bela.h>
+#include <Midi.h>
+#include <stdarg.h>
+#include <vector>
+
+bool hostVerbose = false;
+std::vector<HostMidiEvent> hostMidiLog;
+uint64_t hostMidiTime = 0;
+
+int hostPrintf(const char *format, ...)
+{
+	if(!hostVerbose)
+	{
+		return 0;
+	}
+	va_list args;
+	va_start(args, format);
+	int ret = vprintf(format, args);
+	va_end(args);
+	return ret;
+}
+
+AuxiliaryTask Bela_createAuxiliaryTask(void (*functionToCall)(), int priority, const char *name)
+{
+	return (AuxiliaryTask)functionToCall;
+}
+
+int Bela_scheduleAuxiliaryTask(AuxiliaryTask task)
+{
+	((void (*)())task)();
+	return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ Host stand-in for Midi.h. Output bytes are logged with the sample time of the block they
+ were written in (hostMidiLog), nothing is read.
+*/
+#ifndef HOST_MIDI_H
+#define HOST_MIDI_H
+
+#include <stdint.h>
+#include <vector>
+
+typedef unsigned char midi_byte_t;
+
+struct HostMidiEvent
+{
+	uint64_t sample;
+	midi_byte_t byte;
+};
+
+extern std::vector<HostMidiEvent> hostMidiLog;
+extern uint64_t hostMidiTime; // Set by the replay before each render() call.
+
+class Midi
+{
+public:
+	int readFrom(const char* port) { return 1; }
+	int writeTo(const char* port) { return 1; }
+	void enableParser(bool enable) {}
+	int getInput() { return -1; }
+	int writeOutput(midi_byte_t byte)
+	{
+		HostMidiEvent event = {hostMidiTime, byte};
+		hostMidiLog.push_back(event);
+		return 1;
+	}
+	int writeOutput(midi_byte_t* bytes, unsigned int length)
+	{
+		for(unsigned int i = 0; i < length; i++)
+		{
+			writeOutput(bytes[i]);
+		}
+		return 1;
+	}
+};
+
+#endif /* HOST_MIDI_H */
@@ -0,0 +1,31 @@
+/*
+ Host stand-in for OSCClient.h. Queued messages are counted and dropped.
+*/
+#ifndef HOST_OSCCLIENT_H
+#define HOST_OSCCLIENT_H
+
+#include <oscpkt.h>
+
+class OSCMessageFactory
+{
+public:
+	OSCMessageFactory& to(const std::string& address) { msg.init(address); return *this; }
+	OSCMessageFactory& add(float value) { msg.pushFloat(value); return *this; }
+	OSCMessageFactory& add(int value) { msg.pushInt32(value); return *this; }
+	oscpkt::Message end() { return msg; }
+private:
+	oscpkt::Message msg;
+};
+
+class OSCClient
+{
+public:
+	OSCClient() : sent(0) {}
+	void setup(int port, const char* address = "127.0.0.1", bool scheduleTask = true) {}
+	void queueMessage(oscpkt::Message msg) { sent++; }
+	void sendMessageNow(oscpkt::Message msg) { sent++; }
+	OSCMessageFactory newMessage;
+	int sent;
+};
+
+#endif /* HOST_OSCCLIENT_H */
@@ -0,0 +1,33 @@
+/*
+ Host stand-in for OSCServer.h. Messages are handed in with hostPushOscMessage().
+*/
+#ifndef HOST_OSCSERVER_H
+#define HOST_OSCSERVER_H
+
+#include <oscpkt.h>
+#include <deque>
+
+class OSCServer
+{
+public:
+	void setup(int port) {}
+	bool messageWaiting() { return !queue().empty(); }
+	oscpkt::Message popMessage()
+	{
+		oscpkt::Message msg = queue().front();
+		queue().pop_front();
+		return msg;
+	}
+	static std::deque<oscpkt::Message>& queue()
+	{
+		static std::deque<oscpkt::Message> messages;
+		return messages;
+	}
+};
+
+static inline void hostPushOscMessage(const oscpkt::Message& msg)
+{
+	OSCServer::queue().push_back(msg);
+}
+
+#endif /* HOST_OSCSERVER_H */
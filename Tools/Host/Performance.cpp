@@ -0,0 +1,180 @@
+/*
+ Synthetic drummer (see Performance.h).
+*/
+#include "Performance.h"
+#include <math.h>
+#include <algorithm>
+
+#define MIN_MAP_BPM 20.f // a map that slows down for long enough stops here instead of going through zero.
+#define MAX_MAP_BPM 400.f
+
+PerformanceGenerator::PerformanceGenerator(const TempoMap& m, const Humanize& h)
+	: map(m), human(h), state(h.seed * 0x9E3779B97F4A7C15ull + 1), checkpoint(0), bar(0), beat(0), bpm(m.startBpm),
+	beatTime(0), drift(0), pendingCount(0), pendingRead(0)
+{
+	if(map.checkpoints.empty())
+	{
+		TempoCheckpoint steady = {0, 0.f, FEEL_STRAIGHT};
+		map.checkpoints.push_back(steady);
+	}
+	if(map.beatsPerBar <= 0)
+		map.beatsPerBar = 4;
+}
+
+static bool earlier(const Hit& a, const Hit& b)
+{
+	return a.time < b.time;
+}
+
+double PerformanceGenerator::uniform()
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return ((state * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Sum of four uniforms, near enough to a normal distribution for timing noise and much cheaper than Box-Muller.
+double PerformanceGenerator::gaussian()
+{
+	return (uniform() + uniform() + uniform() + uniform() - 2.0) * 1.7320508;
+}
+
+void PerformanceGenerator::add(double time, float velocity)
+{
+	if(uniform() < human.missRate)
+		return;
+	Hit& hit = pending[pendingCount++];
+	hit.time = time + drift + gaussian() * human.jitterMs / 1000;
+	hit.velocity = velocity;
+	hit.bpm = bpm;
+}
+
+void PerformanceGenerator::playBeat()
+{
+	pendingCount = 0;
+	pendingRead = 0;
+	while(checkpoint + 1 < map.checkpoints.size() && map.checkpoints[checkpoint + 1].bar <= bar)
+	{
+		checkpoint++;
+	}
+	const TempoCheckpoint& section = map.checkpoints[checkpoint];
+	double beatLength = 60.0 / bpm;
+	drift += gaussian() * human.driftMs / 1000;
+	drift = std::max(-human.driftLimitMs / 1000.0, std::min(drift, human.driftLimitMs / 1000.0));
+
+	if(beat == map.beatsPerBar - 1 && uniform() < human.fillRate)
+	{
+		const float fill[4] = {0.65f, 0.6f, 0.6f, 0.55f};
+		for(int s = 0; s < 4; s++)
+			add(beatTime + s * beatLength / 4, fill[s]);
+	}
+	else if(section.feel == FEEL_HALF)
+	{
+		if(beat % 2 == 0)
+			add(beatTime, 0.7 + 0.3 * uniform());
+	}
+	else
+	{
+		add(beatTime, 0.7 + 0.3 * uniform());
+		if(section.feel == FEEL_DOUBLE)
+			add(beatTime + beatLength / 2, 0.7 + 0.3 * uniform());
+	}
+	if(uniform() < human.extraRate) // on one of the sixteenths after the beat.
+	{
+		add(beatTime + beatLength * (1 + (int)(uniform() * 3)) / 4, 0.35 + 0.15 * uniform());
+	}
+
+	// Jitter can swap neighbours, so the beat's hits are put in order (next() keeps them after the last beat's).
+	std::sort(pending, pending + pendingCount, earlier);
+	for(size_t i = 0; i < pendingCount; i++)
+	{
+		pending[i].time = std::max(pending[i].time, 0.0);
+	}
+
+	beatTime += beatLength;
+	bpm = std::max(MIN_MAP_BPM, std::min(bpm + section.increment, MAX_MAP_BPM));
+	if(++beat == map.beatsPerBar)
+	{
+		beat = 0;
+		bar++;
+	}
+}
+
+size_t PerformanceGenerator::next(Hit* hits, size_t max)
+{
+	size_t count = 0;
+	while(count < max)
+	{
+		if(pendingRead == pendingCount)
+		{
+			if(done())
+				break;
+			playBeat();
+			continue;
+		}
+		hits[count] = pending[pendingRead++];
+		if(count > 0 && hits[count].time < hits[count - 1].time)
+			hits[count].time = hits[count - 1].time;
+		count++;
+	}
+	return count;
+}
+
+double PerformanceGenerator::duration() const
+{
+	double time = 0;
+	float b = map.startBpm;
+	size_t c = 0;
+	for(int bar = 0; bar < map.bars; bar++)
+	{
+		while(c + 1 < map.checkpoints.size() && map.checkpoints[c + 1].bar <= bar)
+			c++;
+		for(int beat = 0; beat < map.beatsPerBar; beat++)
+		{
+			time += 60.0 / b;
+			b = std::max(MIN_MAP_BPM, std::min(b + map.checkpoints[c].increment, MAX_MAP_BPM));
+		}
+	}
+	return time;
+}
+
+void generatePerformance(const TempoMap& map, const Humanize& humanize, std::vector<Hit>& hits)
+{
+	PerformanceGenerator generator(map, humanize);
+	hits.clear();
+	Hit batch[256];
+	while(size_t count = generator.next(batch, 256))
+	{
+		hits.insert(hits.end(), batch, batch + count);
+	}
+}
+
+void renderPiezo(const std::vector<Hit>& hits, float rate, float decayMs, float noise, uint64_t seed, Recording& recording)
+{
+	double end = (hits.empty() ? 0 : hits.back().time) + 0.5; // time for the last hit to ring out.
+	size_t length = end * rate;
+	recording.name = "synthetic";
+	recording.times.resize(length);
+	recording.values.resize(length);
+	float decay = expf(-1000.f / (decayMs * rate));
+	uint64_t state = seed * 0x9E3779B97F4A7C15ull + 1;
+	float envelope = 0;
+	size_t h = 0;
+	for(size_t n = 0; n < length; n++)
+	{
+		double t = n / (double)rate;
+		envelope *= decay;
+		while(h < hits.size() && hits[h].time <= t)
+		{
+			envelope = std::max(envelope, hits[h].velocity);
+			h++;
+		}
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		float u = ((state * 0x2545F4914F6CDD1Dull) >> 40) * (1.f / 16777216.f);
+		recording.times[n] = t;
+		recording.values[n] = envelope + noise * u;
+	}
+}
@@ -0,0 +1,105 @@
+/*
+ Synthetic drummer: kick onsets generated from a tempo map, for stress testing the tracker far beyond the
+ few recorded sessions.
+ The tempo map works like the click track in Earlier_Dev/Comparison_Test/render.cpp: the bpm moves by a
+ fixed increment every beat, and at checkpoint bars the increment (and here also the feel) changes. The
+ feel says where the kicks go against the quarter note beat: every beat, every other beat (half time) or
+ every eighth (double time). On top of the map the drummer is humanised:
+	jitter	independent timing error per hit (gaussian, ms).
+	drift	a random walk of how far ahead or behind the beat the drummer is playing (ms per beat,
+		held within driftLimitMs), so the error is correlated from hit to hit as it is for a person.
+	fills	the last beat of a bar broken into four sixteenths, ending a little softer.
+	misses	hits that aren't played.
+	extras	ghost notes between the beats, quieter than the kicks.
+ Every hit carries the true quarter note bpm at its time, so a tool can score the tracker against it.
+
+ PerformanceGenerator hands the hits out in batches and holds no more than the current beat, so any length
+ of performance costs constant memory and generating is tens of millions of hits a second per core.
+ renderPiezo() turns hits into a piezo signal (a decaying pulse per hit on a noise floor) that Replay.h
+ plays like a recording.
+*/
+#ifndef PERFORMANCE_H
+#define PERFORMANCE_H
+
+#include "Replay.h"
+#include <stdint.h>
+#include <vector>
+
+enum Feel
+{
+	FEEL_STRAIGHT = 0, // a kick on every beat.
+	FEEL_HALF = 1, // on every other beat.
+	FEEL_DOUBLE = 2 // on every eighth note.
+};
+
+struct TempoCheckpoint
+{
+	int bar; // takes over at the start of this bar.
+	float increment; // bpm added every beat (negative slows down).
+	int feel;
+};
+
+struct TempoMap
+{
+	float startBpm;
+	int beatsPerBar;
+	int bars; // the performance ends after this many.
+	std::vector<TempoCheckpoint> checkpoints; // in bar order, the first one at bar 0.
+};
+
+struct Humanize
+{
+	float jitterMs;
+	float driftMs;
+	float driftLimitMs;
+	float fillRate; // chance of a fill at the end of each bar.
+	float missRate; // chance of each hit being dropped.
+	float extraRate; // chance of a ghost note after each beat.
+	uint64_t seed;
+};
+
+struct Hit
+{
+	double time; // seconds
+	float velocity; // 0 to 1, kicks from 0.7 up, fills and ghost notes below.
+	float bpm; // the map's bpm at this hit.
+};
+
+class PerformanceGenerator
+{
+public:
+	PerformanceGenerator(const TempoMap& map, const Humanize& humanize);
+
+	// Fills up to max hits, in time order. Returns how many, 0 once the performance is over.
+	size_t next(Hit* hits, size_t max);
+	bool done() const { return bar >= map.bars; }
+	double duration() const; // of the whole map, without the humanising (s).
+
+private:
+	void playBeat();
+	double uniform(); // 0 to 1.
+	double gaussian();
+	void add(double time, float velocity);
+
+	TempoMap map;
+	Humanize human;
+	uint64_t state; // xorshift64*
+	size_t checkpoint;
+	int bar;
+	int beat;
+	float bpm;
+	double beatTime; // seconds, start of the current beat on the map.
+	double drift; // seconds
+	Hit pending[8]; // the current beat's hits, most a beat can have.
+	size_t pendingCount;
+	size_t pendingRead;
+};
+
+// Generates the whole performance.
+void generatePerformance(const TempoMap& map, const Humanize& humanize, std::vector<Hit>& hits);
+
+// A piezo recording of the hits at rate Hz: each hit is a pulse of its velocity decaying with decayMs,
+// on top of uniform noise up to noise.
+void renderPiezo(const std::vector<Hit>& hits, float rate, float decayMs, float noise, uint64_t seed, Recording& recording);
+
+#endif /* PERFORMANCE_H */
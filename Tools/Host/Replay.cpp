@@ -0,0 +1,127 @@
+/*
+ Headless replay of a recorded sensor log through render.cpp (see Replay.h).
+*/
+#include "Replay.h"
+#include "SensorLog.h"
+#include <Bela.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tracker state read after each block.
+extern float bpm;
+extern int beatPos;
+extern const char* snapshotPath;
+extern const char* journalPath;
+
+bool loadRecording(const char* path, Recording& recording)
+{
+	SensorLog log;
+	if(!parseSensorLog(path, log) || log.format != LOG_SENSOR || log.channels.empty())
+	{
+		return false;
+	}
+	recording.name = path;
+	recording.times.swap(log.times);
+	recording.values.swap(log.channels[0]);
+	return true;
+}
+
+bool runReplay(const Recording& recording, const ReplayOptions& options, ReplayResult& result)
+{
+	BelaContext context;
+	memset(&context, 0, sizeof(context));
+	context.audioFrames = options.audioFrames;
+	context.audioInChannels = 2;
+	context.audioOutChannels = 2;
+	context.audioSampleRate = options.audioSampleRate;
+	context.analogInChannels = options.analogChannels;
+	context.analogOutChannels = options.analogChannels;
+	context.analogFrames = options.analogChannels == 8 ? options.audioFrames / 2 : options.audioFrames;
+	context.analogSampleRate = options.audioSampleRate * context.analogFrames / context.audioFrames;
+	context.digitalFrames = options.audioFrames;
+	context.digitalChannels = 16;
+	context.digitalSampleRate = options.audioSampleRate;
+	
+	std::vector<float> audioIn(context.audioFrames * context.audioInChannels);
+	std::vector<float> audioOut(context.audioFrames * context.audioOutChannels);
+	std::vector<float> analogIn(context.analogFrames * context.analogInChannels);
+	std::vector<float> analogOut(context.analogFrames * context.analogOutChannels);
+	std::vector<uint32_t> digital(context.digitalFrames);
+	context.audioIn = &audioIn[0];
+	context.audioOut = &audioOut[0];
+	context.analogIn = &analogIn[0];
+	context.analogOut = &analogOut[0];
+	context.digital = &digital[0];
+	
+	hostVerbose = options.verbose;
+	snapshotPath = options.snapshot;
+	journalPath = options.journal;
+	hostMidiLog.clear();
+	result.bpm.clear();
+	result.beats.clear();
+	
+	if(!setup(&context, 0))
+	{
+		return false;
+	}
+	
+	float duration = recording.times.back();
+	size_t index = 0;
+	float lastBpm = bpm;
+	int lastBeatPos = beatPos;
+	BpmPoint first = {0, bpm};
+	result.bpm.push_back(first);
+	
+	while(context.audioFramesElapsed / context.audioSampleRate < duration)
+	{
+		// Sample and hold the recording at the analog rate.
+		for(unsigned int n = 0; n < context.analogFrames; n++)
+		{
+			float t = (context.audioFramesElapsed + (n * context.audioFrames) / context.analogFrames) / context.audioSampleRate;
+			while(index + 1 < recording.times.size() && recording.times[index + 1] <= t)
+			{
+				index++;
+			}
+			analogIn[n * context.analogInChannels + options.piezoChannel] = recording.values[index];
+		}
+		
+		// Outputs hold their last level, the footswitch is an input.
+		uint32_t levels = digital[context.digitalFrames - 1];
+		for(unsigned int n = 0; n < context.digitalFrames; n++)
+		{
+			digital[n] = levels;
+			if(options.footswitch)
+				digital[n] |= 1u << (16 + P8_08);
+			else
+				digital[n] &= ~(1u << (16 + P8_08));
+		}
+		
+		hostMidiTime = context.audioFramesElapsed;
+		if(options.input)
+		{
+			options.input(&context, options.inputData);
+		}
+		render(&context, 0);
+		
+		if(bpm != lastBpm)
+		{
+			BpmPoint point = {context.audioFramesElapsed, bpm};
+			result.bpm.push_back(point);
+			lastBpm = bpm;
+		}
+		if(beatPos != lastBeatPos)
+		{
+			BeatPoint point = {context.audioFramesElapsed, beatPos};
+			result.beats.push_back(point);
+			lastBeatPos = beatPos;
+		}
+		context.audioFramesElapsed += context.audioFrames;
+	}
+	
+	hostMidiTime = context.audioFramesElapsed;
+	cleanup(&context, 0);
+	result.midi = hostMidiLog;
+	result.samples = context.audioFramesElapsed;
+	return true;
+}
@@ -0,0 +1,73 @@
+/*
+ Headless replay of a recorded sensor log through render.cpp.
+ The recording is played into the piezo analog channel block by block, exactly as the Bela would
+ call render(), and the tracker's output is collected: the bpm trajectory, the beat grid
+ (beatPos changes) and every Midi byte written.
+
+ render.cpp keeps its state in globals, so a process can only replay once: setup() is not
+ written to be run twice. Tools that replay several recordings fork a process per replay.
+
+ Build (from the repository root), together with the tool's own main():
+	g++ -O2 -std=c++11 -pthread -ITools/Host render.cpp Tools/Host/Host.cpp Tools/Host/Replay.cpp Tools/Host/SensorLog.cpp ...
+*/
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <Bela.h>
+#include <Midi.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// A single sensor channel, sample times in seconds.
+struct Recording
+{
+	std::string name;
+	std::vector<float> times;
+	std::vector<float> values;
+};
+
+struct BpmPoint
+{
+	uint64_t sample;
+	float bpm;
+};
+
+struct BeatPoint
+{
+	uint64_t sample;
+	int beatPos;
+};
+
+struct ReplayOptions
+{
+	ReplayOptions() : audioFrames(16), audioSampleRate(44100), analogChannels(8), piezoChannel(6), footswitch(1), verbose(false),
+		snapshot(0), journal(0), input(0), inputData(0) {}
+	unsigned int audioFrames; // block size (the -p setting).
+	float audioSampleRate;
+	unsigned int analogChannels; // 8 channels run at half the audio rate, 4 at the audio rate.
+	unsigned int piezoChannel;
+	int footswitch; // P8_08 level, 1 = TRACK_MODE, 0 = TAP_MODE.
+	bool verbose; // let render.cpp's rt_printf through.
+	const char* snapshot; // render.cpp's snapshot file, 0 to start cold and save nothing.
+	const char* journal; // render.cpp's journal file, 0 for none.
+	void (*input)(BelaContext* context, void* data); // called before each block once the inputs are written, to change them.
+	void* inputData;
+};
+
+struct ReplayResult
+{
+	std::vector<BpmPoint> bpm;
+	std::vector<BeatPoint> beats;
+	std::vector<HostMidiEvent> midi;
+	uint64_t samples;
+};
+
+// Reads the first channel of a ' separated sensor log into a recording (see SensorLog.h, which also
+// puts logs whose rows came out of step, like C1a_PiezoCSV.txt, back in order).
+bool loadRecording(const char* path, Recording& recording);
+
+// Runs setup(), render() for every block of the recording and cleanup(). Once per process.
+bool runReplay(const Recording& recording, const ReplayOptions& options, ReplayResult& result);
+
+#endif /* REPLAY_H */
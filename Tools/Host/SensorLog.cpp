@@ -0,0 +1,579 @@
+/*
+ Loader and time index for the Earlier_Dev logs (see SensorLog.h).
+*/
+#include "SensorLog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <thread>
+
+#define INDEX_VERSION 1 // Bump when the parser changes, so old indexes are rebuilt.
+#define MAX_WIDTH 8 // widest row looked for (time and 7 channels).
+#define MIN_CHUNK 65536 // bytes, smaller files aren't worth splitting.
+
+struct LogIndexHeader
+{
+	char magic[8]; // "PULSEIDX"
+	uint32_t version;
+	uint32_t format;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint64_t rows;
+	uint32_t channels;
+	uint32_t labels;
+	int32_t width;
+	int32_t phase;
+	int32_t duplicateColumns;
+	int32_t restarts;
+	uint64_t skipped;
+	// then times[rows], channel 0[rows], channel 1[rows]... and the label names, each 0 terminated.
+};
+
+// %%%%%%%%%%%% PARSING %%%%%%%%%%%%%%%%%
+
+static bool readWholeFile(const char* path, std::vector<char>& text)
+{
+	FILE* file = fopen(path, "rb");
+	if(!file)
+	{
+		fprintf(stderr, "Can't open %s\n", path);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	text.resize(size + 1);
+	bool ok = size >= 0 && fread(&text[0], 1, size, file) == (size_t)size;
+	fclose(file);
+	text[size] = 0; // so strtof() stops at the end.
+	return ok;
+}
+
+// Chunk boundaries, each just after a line break, so no value or line is split.
+static std::vector<size_t> splitAtLines(const std::vector<char>& text, int threads)
+{
+	size_t size = text.size() - 1;
+	if(threads <= 0)
+	{
+		threads = std::thread::hardware_concurrency();
+	}
+	size_t chunks = std::max<size_t>(1, std::min<size_t>(threads > 0 ? threads : 1, size / MIN_CHUNK));
+	std::vector<size_t> bounds(1, 0);
+	for(size_t c = 1; c < chunks; c++)
+	{
+		size_t at = std::max(bounds.back(), size * c / chunks);
+		while(at < size && text[at - 1] != '\n')
+		{
+			at++;
+		}
+		bounds.push_back(at);
+	}
+	bounds.push_back(size);
+	return bounds;
+}
+
+template<typename Work>
+static void runChunks(const std::vector<size_t>& bounds, Work work)
+{
+	std::vector<std::thread> workers;
+	for(size_t c = 1; c + 1 < bounds.size(); c++)
+	{
+		workers.push_back(std::thread(work, c, bounds[c], bounds[c + 1]));
+	}
+	work(0, bounds[0], bounds[1]);
+	for(size_t w = 0; w < workers.size(); w++)
+	{
+		workers[w].join();
+	}
+}
+
+static void tokenise(const char* text, size_t from, size_t to, std::vector<float>& tokens)
+{
+	const char* p = text + from;
+	const char* end = text + to;
+	while(p < end)
+	{
+		// strtof() skips white space, which could take it over the line break into the next chunk.
+		char* next = (char*)p;
+		float value = 0;
+		if((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.')
+		{
+			value = strtof(p, &next);
+		}
+		if(next == p)
+		{
+			p++;
+			continue;
+		}
+		tokens.push_back(value);
+		p = next;
+	}
+}
+
+// Is every row's time at or after the last one's, and does time move at all?
+static bool timeColumn(const std::vector<float>& tokens, int width, int phase)
+{
+	size_t rows = tokens.size() > (size_t)phase ? (tokens.size() - phase) / width : 0;
+	if(rows < 2)
+	{
+		return false;
+	}
+	for(size_t r = 1; r < rows; r++)
+	{
+		if(tokens[phase + r * width] < tokens[phase + (r - 1) * width])
+		{
+			return false;
+		}
+	}
+	return tokens[phase + (rows - 1) * width] > tokens[phase];
+}
+
+static bool parseSensorValues(const std::vector<char>& text, const std::vector<size_t>& bounds, SensorLog& log)
+{
+	std::vector<std::vector<float> > chunkTokens(bounds.size() - 1);
+	runChunks(bounds, [&](size_t c, size_t from, size_t to) { tokenise(&text[0], from, to, chunkTokens[c]); });
+	std::vector<float> tokens;
+	for(size_t c = 0; c < chunkTokens.size(); c++)
+	{
+		tokens.insert(tokens.end(), chunkTokens[c].begin(), chunkTokens[c].end());
+	}
+
+	// The narrowest row, and the earliest phase, with a time column that never goes backwards.
+	log.width = 0;
+	for(int width = 2; width <= MAX_WIDTH && !log.width; width++)
+	{
+		for(int phase = 0; phase < width && !log.width; phase++)
+		{
+			if(timeColumn(tokens, width, phase))
+			{
+				log.width = width;
+				log.phase = phase;
+			}
+		}
+	}
+	if(!log.width)
+	{
+		fprintf(stderr, "%s: no time column found\n", log.path.c_str());
+		return false;
+	}
+
+	int width = log.width;
+	size_t rows = (tokens.size() - log.phase) / width;
+	log.skipped = tokens.size() - rows * width;
+
+	// Columns that are just the time again are dropped.
+	std::vector<int> columns;
+	for(int k = 1; k < width; k++)
+	{
+		bool duplicate = true;
+		for(size_t r = 0; r < rows && duplicate; r++)
+		{
+			const float* row = &tokens[log.phase + r * width];
+			duplicate = row[k] == row[0];
+		}
+		if(!duplicate)
+		{
+			columns.push_back(k);
+		}
+	}
+	log.duplicateColumns = width - 1 - columns.size();
+	log.restarts = 0;
+
+	// A last row cut short still counts if it got as far as the last channel.
+	size_t leftover = tokens.size() - log.phase - rows * width;
+	if(!columns.empty() && leftover > (size_t)columns.back())
+	{
+		rows++;
+		log.skipped -= columns.back() + 1;
+	}
+
+	log.times.resize(rows);
+	log.channels.assign(columns.size(), std::vector<float>(rows));
+	for(size_t r = 0; r < rows; r++)
+	{
+		const float* row = &tokens[log.phase + r * width];
+		log.times[r] = row[0];
+		for(size_t c = 0; c < columns.size(); c++)
+		{
+			log.channels[c][r] = row[columns[c]];
+		}
+	}
+	return true;
+}
+
+struct PredictionChunk
+{
+	std::vector<float> frames;
+	std::vector<int> labels;
+	std::vector<int> unfiltered;
+	std::vector<std::string> names; // this chunk's label table.
+	size_t skipped;
+};
+
+// "[STILL]" and "STILL" are the same label.
+static int labelId(PredictionChunk& chunk, const char* p, const char** end)
+{
+	while(*p == ' ' || *p == '\t')
+		p++;
+	const char* e = p;
+	while(*e && *e != ' ' && *e != '\t' && *e != '\n' && *e != '\r')
+		e++;
+	*end = e;
+	const char* a = p;
+	const char* b = e;
+	if(b - a >= 2 && *a == '[' && b[-1] == ']')
+	{
+		a++;
+		b--;
+	}
+	std::string name(a, b);
+	for(size_t i = 0; i < chunk.names.size(); i++)
+	{
+		if(chunk.names[i] == name)
+			return i;
+	}
+	chunk.names.push_back(name);
+	return chunk.names.size() - 1;
+}
+
+// Like strstr(), but only as far as the end of the line.
+static const char* findInLine(const char* p, const char* lineEnd, const char* what)
+{
+	const char* found = std::search(p, lineEnd, what, what + strlen(what));
+	return found != lineEnd ? found : 0;
+}
+
+static void parsePredictionLines(const char* text, size_t from, size_t to, PredictionChunk& chunk)
+{
+	chunk.skipped = 0;
+	const char* p = text + from;
+	const char* end = text + to;
+	while(p < end)
+	{
+		const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+		if(!lineEnd)
+			lineEnd = end;
+		char* afterFrame;
+		long frame = strtol(p, &afterFrame, 10);
+		const char* prediction = afterFrame != p && afterFrame < lineEnd ? findInLine(afterFrame, lineEnd, "Prediction:") : 0; // strtol() can skip a blank line.
+		if(prediction && findInLine(prediction + 11, lineEnd, "Prediction:"))
+		{
+			// Two lines run together ("1168   Prediction:     0   Prediction:     NIL"): the first lost its
+			// label and the second starts where that label should be.
+			chunk.skipped++;
+			p = prediction + 11;
+			continue;
+		}
+		if(prediction)
+		{
+			const char* q;
+			int label = labelId(chunk, prediction + 11, &q);
+			const char* u = findInLine(q, lineEnd, "(U)");
+			int unfiltered = u ? labelId(chunk, u + 3, &q) : label; // the first lines only have the one label.
+			chunk.frames.push_back(frame);
+			chunk.labels.push_back(label);
+			chunk.unfiltered.push_back(unfiltered);
+		}
+		else if(lineEnd > p + 1)
+		{
+			chunk.skipped++; // "End Of Set" and the like.
+		}
+		p = lineEnd + 1;
+	}
+}
+
+static bool parsePredictions(const std::vector<char>& text, const std::vector<size_t>& bounds, SensorLog& log)
+{
+	std::vector<PredictionChunk> chunks(bounds.size() - 1);
+	runChunks(bounds, [&](size_t c, size_t from, size_t to) { parsePredictionLines(&text[0], from, to, chunks[c]); });
+
+	log.width = 3;
+	log.phase = 0;
+	log.duplicateColumns = 0;
+	log.skipped = 0;
+	log.channels.assign(2, std::vector<float>());
+	std::map<std::string, int> ids;
+	for(size_t c = 0; c < chunks.size(); c++)
+	{
+		// Chunk label ids onto the log's label table.
+		std::vector<int> remap(chunks[c].names.size());
+		for(size_t i = 0; i < remap.size(); i++)
+		{
+			std::map<std::string, int>::iterator it = ids.find(chunks[c].names[i]);
+			if(it == ids.end())
+			{
+				it = ids.insert(std::make_pair(chunks[c].names[i], (int)log.labels.size())).first;
+				log.labels.push_back(chunks[c].names[i]);
+			}
+			remap[i] = it->second;
+		}
+		for(size_t r = 0; r < chunks[c].frames.size(); r++)
+		{
+			log.times.push_back(chunks[c].frames[r]);
+			log.channels[0].push_back(remap[chunks[c].labels[r]]);
+			log.channels[1].push_back(remap[chunks[c].unfiltered[r]]);
+		}
+		log.skipped += chunks[c].skipped;
+	}
+
+	// The frame count starts again with each set, so later sets carry on from the end of the one before.
+	log.restarts = 0;
+	float offset = 0;
+	for(size_t r = 1; r < log.times.size(); r++)
+	{
+		if(log.times[r] + offset < log.times[r - 1])
+		{
+			offset = log.times[r - 1] + 1 - log.times[r];
+			log.restarts++;
+		}
+		log.times[r] += offset;
+	}
+	return !log.times.empty();
+}
+
+bool parseSensorLog(const char* path, SensorLog& log, int threads)
+{
+	std::vector<char> text;
+	if(!readWholeFile(path, text))
+		return false;
+	log.path = path;
+	log.times.clear();
+	log.channels.clear();
+	log.labels.clear();
+
+	std::vector<size_t> bounds = splitAtLines(text, threads);
+	size_t sniff = std::min<size_t>(text.size() - 1, 4096);
+	if(std::search(text.begin(), text.begin() + sniff, "Prediction:", "Prediction:" + 11) != text.begin() + sniff)
+	{
+		log.format = LOG_PREDICTIONS;
+		return parsePredictions(text, bounds, log);
+	}
+	log.format = LOG_SENSOR;
+	return parseSensorValues(text, bounds, log);
+}
+
+// %%%%%%%%%%%% INDEX %%%%%%%%%%%%%%%%%
+
+static bool makeDirectories(const std::string& path)
+{
+	for(size_t at = 1; at <= path.size(); at++)
+	{
+		if(at == path.size() || path[at] == '/')
+		{
+			std::string part = path.substr(0, at);
+			if(mkdir(part.c_str(), 0755) && errno != EEXIST)
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool writeIndex(const std::string& indexFile, const SensorLog& log, uint64_t sourceSize, int64_t sourceTime)
+{
+	LogIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "PULSEIDX", 8);
+	header.version = INDEX_VERSION;
+	header.format = log.format;
+	header.sourceSize = sourceSize;
+	header.sourceTime = sourceTime;
+	header.rows = log.times.size();
+	header.channels = log.channels.size();
+	header.labels = log.labels.size();
+	header.width = log.width;
+	header.phase = log.phase;
+	header.duplicateColumns = log.duplicateColumns;
+	header.restarts = log.restarts;
+	header.skipped = log.skipped;
+
+	// Written next to the index and renamed over it, so a reader never maps half a file.
+	char temporary[32];
+	snprintf(temporary, sizeof(temporary), ".%d.tmp", (int)getpid());
+	std::string temporaryFile = indexFile + temporary;
+	FILE* file = fopen(temporaryFile.c_str(), "wb");
+	if(!file)
+		return false;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	if(!log.times.empty())
+	{
+		ok = ok && fwrite(&log.times[0], sizeof(float), log.times.size(), file) == log.times.size();
+		for(size_t c = 0; c < log.channels.size(); c++)
+		{
+			ok = ok && fwrite(&log.channels[c][0], sizeof(float), log.times.size(), file) == log.times.size();
+		}
+	}
+	for(size_t l = 0; l < log.labels.size(); l++)
+	{
+		ok = ok && fwrite(log.labels[l].c_str(), 1, log.labels[l].size() + 1, file) == log.labels[l].size() + 1;
+	}
+	ok = fclose(file) == 0 && ok;
+	if(!ok || rename(temporaryFile.c_str(), indexFile.c_str()))
+	{
+		unlink(temporaryFile.c_str());
+		return false;
+	}
+	return true;
+}
+
+LogIndex::LogIndex() : data(0), length(0), header(0), wasRebuilt(false)
+{
+}
+
+LogIndex::~LogIndex()
+{
+	close();
+}
+
+void LogIndex::close()
+{
+	if(data)
+	{
+		munmap(data, length);
+	}
+	data = 0;
+	length = 0;
+	header = 0;
+	labelNames.clear();
+}
+
+std::string LogIndex::indexPath(const char* path, const char* indexDirectory)
+{
+	// File name plus a hash of the whole path, so logs with the same name in different folders don't meet.
+	uint64_t hash = 14695981039346656037ull;
+	for(const char* p = path; *p; p++)
+	{
+		hash = (hash ^ (unsigned char)*p) * 1099511628211ull;
+	}
+	const char* name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), "-%016llx.idx", (unsigned long long)hash);
+	return std::string(indexDirectory) + "/" + name + suffix;
+}
+
+bool LogIndex::map(const std::string& indexFile, uint64_t sourceSize, int64_t sourceTime)
+{
+	close();
+	int fd = ::open(indexFile.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat st;
+	if(fstat(fd, &st) || (size_t)st.st_size < sizeof(LogIndexHeader))
+	{
+		::close(fd);
+		return false;
+	}
+	length = st.st_size;
+	data = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(data == MAP_FAILED)
+	{
+		data = 0;
+		return false;
+	}
+
+	header = (const LogIndexHeader*)data;
+	size_t columns = ((size_t)header->channels + 1) * header->rows * sizeof(float);
+	bool ok = !memcmp(header->magic, "PULSEIDX", 8) && header->version == INDEX_VERSION
+		&& header->sourceSize == sourceSize && header->sourceTime == sourceTime
+		&& sizeof(LogIndexHeader) + columns <= length;
+
+	// Label names follow the columns.
+	const char* p = (const char*)data + sizeof(LogIndexHeader) + columns;
+	const char* end = (const char*)data + length;
+	for(uint32_t l = 0; ok && l < header->labels; l++)
+	{
+		const char* zero = (const char*)memchr(p, 0, end - p);
+		ok = zero != 0;
+		labelNames.push_back(p);
+		p = zero + 1;
+	}
+	if(!ok)
+	{
+		close();
+	}
+	return ok;
+}
+
+bool LogIndex::open(const char* path, const char* indexDirectory, int threads)
+{
+	wasRebuilt = false;
+	struct stat st;
+	if(stat(path, &st))
+	{
+		fprintf(stderr, "Can't open %s\n", path);
+		return false;
+	}
+	std::string indexFile = indexPath(path, indexDirectory);
+	if(map(indexFile, st.st_size, st.st_mtime))
+		return true;
+
+	SensorLog log;
+	if(!parseSensorLog(path, log, threads))
+		return false;
+	if(!makeDirectories(indexDirectory) || !writeIndex(indexFile, log, st.st_size, st.st_mtime))
+	{
+		fprintf(stderr, "Can't write %s\n", indexFile.c_str());
+		return false;
+	}
+	wasRebuilt = true;
+	return map(indexFile, st.st_size, st.st_mtime);
+}
+
+LogFormat LogIndex::format() const
+{
+	return (LogFormat)header->format;
+}
+
+size_t LogIndex::size() const
+{
+	return header ? header->rows : 0;
+}
+
+unsigned int LogIndex::numChannels() const
+{
+	return header ? header->channels : 0;
+}
+
+const float* LogIndex::times() const
+{
+	return (const float*)(header + 1);
+}
+
+const float* LogIndex::channel(unsigned int c) const
+{
+	return times() + (size_t)(c + 1) * header->rows;
+}
+
+unsigned int LogIndex::numLabels() const
+{
+	return labelNames.size();
+}
+
+const char* LogIndex::label(unsigned int l) const
+{
+	return l < labelNames.size() ? labelNames[l] : "";
+}
+
+std::string LogIndex::layout() const
+{
+	char text[128];
+	snprintf(text, sizeof(text), "%d values a row from %d, %d duplicate time, %llu skipped, %d restarts",
+		header->width, header->phase, header->duplicateColumns, (unsigned long long)header->skipped, header->restarts);
+	return text;
+}
+
+void LogIndex::range(float from, float to, size_t& first, size_t& last) const
+{
+	const float* begin = times();
+	const float* end = begin + size();
+	first = std::lower_bound(begin, end, from) - begin;
+	last = std::max(first, (size_t)(std::lower_bound(begin, end, to) - begin));
+}
@@ -0,0 +1,90 @@
+/*
+ Loader and time index for the Earlier_Dev logs.
+ Two kinds of log are in the archive, both ' separated text:
+	sensor logs		WriteFile output, a time column then one or more channels per row. The writer logs
+				a fixed number of values per sample but the line breaks don't always match (see
+				C1a_PiezoCSV.txt, where every row is time'value'time across two lines), so the file
+				is read as one stream of values and the row width, the phase of the time column and
+				any column that only repeats the time are worked out from the values themselves.
+	prediction dumps	"<frame>   Prediction:     <label>    (U)[<label>]" per line (Test_w_TimeOutFilter.txt).
+				The frame number is the time, the filtered and unfiltered labels are the two
+				channels (as indices into the label table). Where two lines ran together the
+				first is dropped, and when the frame count starts again the times carry on.
+ parseSensorLog() splits the file into chunks at line breaks and parses them on all cores.
+
+ LogIndex keeps the parsed columns in a binary file (one per log, in an index directory) that is mapped
+ straight into memory. It is rebuilt when the log's size or modification time changes, and a time range
+ is found by binary search on the time column, so a query never touches the text again.
+*/
+#ifndef SENSOR_LOG_H
+#define SENSOR_LOG_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum LogFormat
+{
+	LOG_SENSOR = 0,
+	LOG_PREDICTIONS = 1
+};
+
+struct SensorLog
+{
+	std::string path;
+	LogFormat format;
+	std::vector<float> times; // seconds for sensor logs, frames for prediction dumps.
+	std::vector<std::vector<float> > channels;
+	std::vector<std::string> labels; // prediction dumps: label names, channel values index them.
+
+	// What the parser found out about the layout.
+	int width; // values per row in the file, time included.
+	int phase; // value the first whole row starts at.
+	int duplicateColumns; // columns that only repeated the time, dropped.
+	size_t skipped; // values (or lines) left over that weren't part of a whole row.
+	int restarts; // prediction dumps: times the frame count started again (the times carry on across them).
+};
+
+// threads = 0 uses every core.
+bool parseSensorLog(const char* path, SensorLog& log, int threads = 0);
+
+struct LogIndexHeader;
+
+class LogIndex
+{
+public:
+	LogIndex();
+	~LogIndex();
+
+	// Maps the index for this log, building it first if it is missing or older than the log.
+	bool open(const char* path, const char* indexDirectory, int threads = 0);
+	void close();
+	bool rebuilt() const { return wasRebuilt; }
+
+	LogFormat format() const;
+	size_t size() const; // rows
+	unsigned int numChannels() const;
+	const float* times() const;
+	const float* channel(unsigned int c) const;
+	unsigned int numLabels() const;
+	const char* label(unsigned int l) const;
+	std::string layout() const; // what the parser found, e.g. "3 values a row from 0, 1 duplicate time".
+
+	// Rows with from <= time < to, as [first, last).
+	void range(float from, float to, size_t& first, size_t& last) const;
+
+	static std::string indexPath(const char* path, const char* indexDirectory);
+
+private:
+	LogIndex(const LogIndex&);
+	LogIndex& operator=(const LogIndex&);
+	bool map(const std::string& indexFile, uint64_t sourceSize, int64_t sourceTime);
+
+	void* data;
+	size_t length;
+	const LogIndexHeader* header;
+	std::vector<const char*> labelNames;
+	bool wasRebuilt;
+};
+
+#endif /* SENSOR_LOG_H */
@@ -0,0 +1,232 @@
+/*
+ A recording session lined up on one time grid (see Session.h).
+*/
+#include "Session.h"
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+int SessionFrame::find(const char* name) const
+{
+	for(size_t s = 0; s < names.size(); s++)
+	{
+		if(names[s] == name)
+			return s;
+	}
+	return -1;
+}
+
+Session::Session() : audio(0), audioLength(0), audioBytes(0)
+{
+}
+
+Session::~Session()
+{
+	close();
+}
+
+void Session::close()
+{
+	for(size_t l = 0; l < logs.size(); l++)
+	{
+		delete logs[l];
+	}
+	logs.clear();
+	streams.clear();
+	if(audio)
+	{
+		munmap((void*)audio, audioBytes);
+	}
+	audio = 0;
+	audioLength = 0;
+	audioBytes = 0;
+}
+
+static bool endsWith(const std::string& text, const char* end)
+{
+	size_t length = strlen(end);
+	return text.size() >= length && !text.compare(text.size() - length, length, end);
+}
+
+bool Session::open(const char* directory, const char* prefix, const char* indexDirectory)
+{
+	close();
+	DIR* dir = opendir(directory);
+	if(!dir)
+	{
+		fprintf(stderr, "Can't open %s\n", directory);
+		return false;
+	}
+	std::string start = std::string(prefix) + "_";
+	std::string end = "(" + std::string(prefix) + ").txt"; // <stream>(<session>).txt, as the Comparison Study.
+	std::vector<std::string> files;
+	while(struct dirent* entry = readdir(dir))
+	{
+		if(!strncmp(entry->d_name, start.c_str(), start.size()) || (endsWith(entry->d_name, end.c_str()) && strlen(entry->d_name) > end.size()))
+			files.push_back(entry->d_name);
+	}
+	closedir(dir);
+	std::sort(files.begin(), files.end()); // the same stream order every time.
+
+	for(size_t f = 0; f < files.size(); f++)
+	{
+		std::string path = std::string(directory) + "/" + files[f];
+		std::string name = endsWith(files[f], end.c_str()) ? files[f].substr(0, files[f].size() - end.size()) + ".txt" : files[f].substr(start.size());
+		if(endsWith(name, ".txt"))
+		{
+			LogIndex* log = new LogIndex;
+			if(!log->open(path.c_str(), indexDirectory) || log->format() != LOG_SENSOR)
+			{
+				delete log;
+				continue;
+			}
+			logs.push_back(log);
+			name.resize(name.size() - 4);
+			for(unsigned int c = 0; c < log->numChannels(); c++)
+			{
+				Stream stream = {name, log, c};
+				if(log->numChannels() > 1)
+				{
+					char suffix[16];
+					snprintf(suffix, sizeof(suffix), ".%u", c);
+					stream.name += suffix;
+				}
+				streams.push_back(stream);
+			}
+		}
+		else if(name == "Audio" && !audio)
+		{
+			int fd = ::open(path.c_str(), O_RDONLY);
+			struct stat st;
+			if(fd < 0 || fstat(fd, &st) || st.st_size < (off_t)sizeof(float))
+			{
+				if(fd >= 0)
+					::close(fd);
+				continue;
+			}
+			void* data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			::close(fd);
+			if(data == MAP_FAILED)
+				continue;
+			audio = (const float*)data;
+			audioBytes = st.st_size;
+			audioLength = st.st_size / sizeof(float);
+			Stream stream = {name, 0, 0};
+			streams.push_back(stream);
+		}
+	}
+	if(streams.empty())
+	{
+		fprintf(stderr, "No %s streams in %s\n", prefix, directory);
+		return false;
+	}
+	return true;
+}
+
+size_t Session::streamLength(size_t s) const
+{
+	return streams[s].log ? streams[s].log->size() : audioLength;
+}
+
+float Session::streamRate(size_t s) const
+{
+	const LogIndex* log = streams[s].log;
+	if(!log)
+		return SESSION_AUDIO_RATE;
+	if(log->size() < 2)
+		return 0;
+	return (log->size() - 1) / (log->times()[log->size() - 1] - log->times()[0]);
+}
+
+float Session::duration() const
+{
+	float end = audioLength / SESSION_AUDIO_RATE;
+	for(size_t l = 0; l < logs.size(); l++)
+	{
+		if(logs[l]->size())
+			end = std::max(end, logs[l]->times()[logs[l]->size() - 1]);
+	}
+	return end;
+}
+
+void Session::resampleLog(const Stream& stream, float from, float rate, size_t frames, float* out) const
+{
+	const float* times = stream.log->times();
+	const float* values = stream.log->channel(stream.channel);
+	size_t n = stream.log->size();
+	size_t i = std::lower_bound(times, times + n, from) - times;
+	for(size_t k = 0; k < frames; k++)
+	{
+		float t = from + k / rate;
+		while(i < n && times[i] < t)
+		{
+			i++;
+		}
+		if(i == 0)
+			out[k] = values[0];
+		else if(i == n)
+			out[k] = values[n - 1];
+		else
+		{
+			// Between rows i - 1 and i.
+			float span = times[i] - times[i - 1];
+			float w = span > 0 ? (t - times[i - 1]) / span : 1;
+			out[k] = values[i - 1] + w * (values[i] - values[i - 1]);
+		}
+	}
+}
+
+void Session::resampleAudio(float from, float rate, size_t frames, float* out) const
+{
+	double step = SESSION_AUDIO_RATE / rate; // audio samples per frame.
+	for(size_t k = 0; k < frames; k++)
+	{
+		double position = (from + k / (double)rate) * SESSION_AUDIO_RATE;
+		if(step > 1)
+		{
+			// Mean of the samples the frame covers.
+			long first = std::max(0l, std::min((long)position, (long)audioLength - 1));
+			long last = std::max(first + 1, std::min((long)(position + step), (long)audioLength));
+			double sum = 0;
+			for(long a = first; a < last; a++)
+			{
+				sum += audio[a];
+			}
+			out[k] = sum / (last - first);
+		}
+		else
+		{
+			long a = (long)position;
+			if(a < 0)
+				out[k] = audio[0];
+			else if(a + 1 >= (long)audioLength)
+				out[k] = audio[audioLength - 1];
+			else
+				out[k] = audio[a] + (position - a) * (audio[a + 1] - audio[a]);
+		}
+	}
+}
+
+void Session::resample(float from, float rate, size_t frames, SessionFrame& frame) const
+{
+	frame.from = from;
+	frame.rate = rate;
+	frame.frames = frames;
+	frame.names.resize(streams.size());
+	frame.data.resize(streams.size() * frames);
+	for(size_t s = 0; s < streams.size(); s++)
+	{
+		frame.names[s] = streams[s].name;
+		if(!frames)
+			continue;
+		if(streams[s].log)
+			resampleLog(streams[s], from, rate, frames, &frame.data[s * frames]);
+		else
+			resampleAudio(from, rate, frames, &frame.data[s * frames]);
+	}
+}
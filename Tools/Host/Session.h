@@ -0,0 +1,75 @@
+/*
+ A recording session: every stream logged at the same time, lined up on one time grid.
+ The C1a session in Earlier_Dev/Sensors-_OSC is split over one log per sensor (C1a_LAnkle.txt,
+ C1a_LWrist.txt...), each with its own rows and times, plus C1a_Audio, raw 32 bit floats at the audio
+ rate. Session maps all of them (the logs through LogIndex, see SensorLog.h, the audio file as it is),
+ so nothing is parsed or copied up front. The Comparison Study in Earlier_Dev/Comparison_Test names its logs
+ the other way round, <stream>(<session>).txt, and opens the same way with Comparison_Study as the prefix.
+
+ resample() fills a SessionFrame for any stretch of the session at any rate: one contiguous column per
+ stream (structure of arrays), frame k of every column at from + k / rate seconds. Log channels are
+ interpolated linearly between rows and the audio is averaged over each frame when the grid is coarser
+ than the audio rate. Before the first row and after the last a stream holds its end value.
+ Stream names are the part of the file name after the session prefix, with ".0", ".1"... when a log
+ has more than one channel (the wrists log x and z).
+*/
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "SensorLog.h"
+#include <string>
+#include <vector>
+
+#define SESSION_AUDIO_RATE 44100.f
+
+struct SessionFrame
+{
+	float from; // seconds
+	float rate;
+	size_t frames;
+	std::vector<std::string> names;
+	std::vector<float> data; // stream s is data[s * frames] to data[(s + 1) * frames - 1].
+
+	const float* stream(size_t s) const { return &data[s * frames]; }
+	int find(const char* name) const; // -1 if there isn't one.
+};
+
+class Session
+{
+public:
+	Session();
+	~Session();
+
+	// Maps every <prefix>_* and *(<prefix>).txt log and the <prefix>_Audio file in the directory.
+	bool open(const char* directory, const char* prefix, const char* indexDirectory = ".logindex");
+	void close();
+
+	size_t numStreams() const { return streams.size(); }
+	const char* streamName(size_t s) const { return streams[s].name.c_str(); }
+	float streamRate(size_t s) const; // mean rows per second.
+	size_t streamLength(size_t s) const;
+	float duration() const; // end of the longest stream (s).
+
+	void resample(float from, float rate, size_t frames, SessionFrame& frame) const;
+
+private:
+	Session(const Session&);
+	Session& operator=(const Session&);
+
+	struct Stream
+	{
+		std::string name;
+		const LogIndex* log; // 0 for the audio.
+		unsigned int channel;
+	};
+	void resampleLog(const Stream& stream, float from, float rate, size_t frames, float* out) const;
+	void resampleAudio(float from, float rate, size_t frames, float* out) const;
+
+	std::vector<LogIndex*> logs;
+	std::vector<Stream> streams;
+	const float* audio;
+	size_t audioLength; // samples
+	size_t audioBytes;
+};
+
+#endif /* SESSION_H */
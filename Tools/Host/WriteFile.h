@@ -0,0 +1,21 @@
+/*
+ Host stand-in for WriteFile.h. Nothing is written.
+*/
+#ifndef HOST_WRITEFILE_H
+#define HOST_WRITEFILE_H
+
+enum { kText, kBinary };
+
+class WriteFile
+{
+public:
+	void init(const char* filename) {}
+	void setFormat(const char* format) {}
+	void setFileType(int type) {}
+	void setHeader(const char* header) {}
+	void setFooter(const char* footer) {}
+	void log(float value) {}
+	void log(const float* values, int length) {}
+};
+
+#endif /* HOST_WRITEFILE_H */
@@ -0,0 +1,66 @@
+/*
+ Host stand-in for the little of oscpkt that render.cpp uses. Messages carry int and float
+ arguments only, which is all the Pulse sends and receives.
+*/
+#ifndef HOST_OSCPKT_H
+#define HOST_OSCPKT_H
+
+#include <string>
+#include <vector>
+
+namespace oscpkt {
+
+class Message
+{
+public:
+	struct Arg
+	{
+		char type; // 'i' or 'f'
+		int i;
+		float f;
+	};
+
+	class ArgReader
+	{
+	public:
+		ArgReader(const Message* m, bool matched) : msg(m), pos(0), ok(matched) {}
+		ArgReader& popFloat(float& value)
+		{
+			if(ok && pos < msg->args.size() && msg->args[pos].type == 'f')
+				value = msg->args[pos++].f;
+			else
+				ok = false;
+			return *this;
+		}
+		ArgReader& popInt32(int& value)
+		{
+			if(ok && pos < msg->args.size() && msg->args[pos].type == 'i')
+				value = msg->args[pos++].i;
+			else
+				ok = false;
+			return *this;
+		}
+		bool isOk() const { return ok; }
+		bool isOkNoMoreArgs() const { return ok && pos == msg->args.size(); }
+	private:
+		const Message* msg;
+		size_t pos;
+		bool ok;
+	};
+
+	Message() {}
+	Message(const std::string& address) : addr(address) {}
+	Message& init(const std::string& address) { addr = address; args.clear(); return *this; }
+	Message& pushFloat(float value) { Arg a = {'f', 0, value}; args.push_back(a); return *this; }
+	Message& pushInt32(int value) { Arg a = {'i', value, 0}; args.push_back(a); return *this; }
+	ArgReader match(const std::string& test) const { return ArgReader(this, test == addr); }
+	ArgReader arg() const { return ArgReader(this, true); }
+	const std::string& addressPattern() const { return addr; }
+
+	std::string addr;
+	std::vector<Arg> args;
+};
+
+} // namespace oscpkt
+
+#endif /* HOST_OSCPKT_H */
@@ -0,0 +1,13 @@
+/*
+ Host stand-in for rtdk.h. Printing from render.cpp is off unless hostVerbose is set,
+ because the tracker prints a lot per onset and a replay goes through thousands of them.
+*/
+#ifndef HOST_RTDK_H
+#define HOST_RTDK_H
+
+extern bool hostVerbose;
+int hostPrintf(const char *format, ...);
+
+#define rt_printf hostPrintf
+
+#endif /* HOST_RTDK_H */
@@ -0,0 +1,366 @@
+/*
+ Session journals (Journal.h): prints one, or replays it through render.cpp to check that the tracker makes the
+ same decisions again, so a session that went wrong can be stepped through on the laptop.
+ The replay puts the journal back in as the inputs, block by block:
+	footswitch	the level read in each block, from the JOURNAL_SWITCH records
+	parameters	each set at the block it was taken in, through render.cpp's publishParams()
+	piezo		each onset's classifier window as it was recorded, then held at the onset's peak (above
+			both thresholds) until the frame it was released on, then 0
+	snapshot	the one the session was restored from, if any, and whether it resumed the clock
+ render.cpp journals the replay as well, and the two journals are compared record by record, to the sample, on
+ everything but the header, parameters and snapshot: footswitch, modes, onsets and their labels, releases,
+ tracker decisions, resets and Midi bytes. The first difference is printed. The time the replay took is printed
+ too, and it can be run under a profiler or with --verbose (render.cpp's rt_printf) to see what happened when.
+ Sessions taken from the audio input (onsetSource 1) can't be replayed, as the journal has its level, not the
+ audio, and a journal that dropped records won't match after the first drop.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -I. -ITools/Host render.cpp Tools/Host/Host.cpp Tools/Host/Replay.cpp Tools/Host/SensorLog.cpp Tools/Journal/journal.cpp -o journal
+	./journal dump journal-20240601-213000.pj
+	./journal replay journal-20240601-213000.pj [--verbose] [--keep replay.pj]
+*/
+#include "Replay.h"
+#include "Journal.h"
+#include "Snapshot.h"
+#include "OnsetClassifier.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+
+extern int snapshotResume; // render.cpp
+bool publishParams(const void* data, size_t size);
+
+struct JournalOnset
+{
+	uint64_t frame; // analog frame of the crossing.
+	uint64_t release; // analog frame it was released on (never, if the session ended first).
+	float peak;
+	std::vector<float> window;
+};
+
+struct JournalInputs
+{
+	unsigned int audioFrames;
+	unsigned int analogFrames;
+	std::vector<JournalEntry> switches;
+	std::vector<JournalEntry> params;
+	std::vector<JournalOnset> onsets;
+	size_t nextSwitch;
+	size_t nextParams;
+	size_t nextOnset;
+	int footswitch;
+};
+
+static bool readJournal(const char* path, std::vector<JournalEntry>& entries)
+{
+	FILE* file = fopen(path, "rb");
+	if(!file)
+	{
+		fprintf(stderr, "Can't open %s\n", path);
+		return false;
+	}
+	// The least payload each type has, to tell a damaged file from a journal.
+	static const size_t minimumSize[] = {20, 0, 8, 1, 1, 8, 0, sizeof(JournalTempo), 0, 1, 4};
+	JournalEntry e;
+	while(readJournalEntry(file, e))
+	{
+		if(e.type < 0 || e.type > JOURNAL_DROPPED || e.payload.size() < minimumSize[e.type] || (e.type == JOURNAL_HEADER) != entries.empty())
+		{
+			fprintf(stderr, "%s is damaged after %zu records, reading only those\n", path, entries.size());
+			break;
+		}
+		entries.push_back(e);
+	}
+	fclose(file);
+	uint32_t magic = 0;
+	if(!entries.empty())
+	{
+		memcpy(&magic, &entries[0].payload[0], 4);
+	}
+	if(magic != JOURNAL_MAGIC)
+	{
+		fprintf(stderr, "%s isn't a journal\n", path);
+		return false;
+	}
+	return true;
+}
+
+static void dumpEntry(const JournalEntry& e, float rate)
+{
+	const unsigned char* p = e.payload.empty() ? 0 : &e.payload[0];
+	printf("%12llu %10.4f s  %-8s", (unsigned long long)e.sample, e.sample / rate,
+		e.type >= 0 && e.type <= JOURNAL_DROPPED ? journalTypeNames[e.type] : "?");
+	switch(e.type)
+	{
+		case JOURNAL_HEADER:
+		{
+			uint32_t h[5];
+			memcpy(h, p, sizeof(h));
+			printf(" version %u, %.0f Hz, %u audio and %u analog frames a block", h[1], rate, h[3], h[4]);
+			break;
+		}
+		case JOURNAL_RESTORED:
+			printf(" snapshot version %u, %s", p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24, p[4] ? "resumed" : "not resumed");
+			break;
+		case JOURNAL_SWITCH:
+			printf(" %s", p[0] ? "TRACK" : "TAP");
+			break;
+		case JOURNAL_MODE:
+			printf(" %s", p[0] ? "TRACK" : "TAP");
+			break;
+		case JOURNAL_ONSET:
+		{
+			float peak = 0;
+			for(size_t s = 4; s + 4 <= e.payload.size(); s += 4)
+			{
+				float v;
+				memcpy(&v, p + s, 4);
+				peak = std::max(peak, v);
+			}
+			printf(" %s, peak %.3f, %zu samples", p[0] <= ONSET_BLEED ? onsetClassNames[p[0]] : "?", peak, e.payload.size() / 4 - 1);
+			break;
+		}
+		case JOURNAL_TEMPO:
+		{
+			JournalTempo t;
+			memcpy(&t, p, sizeof(t));
+			printf(" %s bpm %.2f, threshold %.3f, accuracy %.3f, syncDelta %.3f, beatPos %d", t.mode ? "TRACK" : "TAP",
+				t.bpm, t.tempoThreshold, t.accuracy, t.syncDelta, t.beatPos);
+			break;
+		}
+		case JOURNAL_MIDI:
+			for(size_t b = 0; b < e.payload.size(); b++)
+				printf(" %d", p[b]);
+			break;
+		case JOURNAL_DROPPED:
+			printf(" %u records", p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24);
+			break;
+		case JOURNAL_PARAMS:
+			printf(" %zu bytes", e.payload.size());
+			break;
+	}
+	printf("\n");
+}
+
+static void dump(const std::vector<JournalEntry>& entries)
+{
+	float rate;
+	memcpy(&rate, &entries[0].payload[8], 4);
+	for(size_t i = 0; i < entries.size(); i++)
+	{
+		dumpEntry(entries[i], rate);
+	}
+}
+
+// Replay.h's input hook: the journal's footswitch, parameters and piezo for this block.
+static void journalInput(BelaContext* context, void* data)
+{
+	JournalInputs& in = *(JournalInputs*)data;
+	uint64_t blockStart = context->audioFramesElapsed;
+	while(in.nextSwitch < in.switches.size() && in.switches[in.nextSwitch].sample <= blockStart)
+	{
+		in.footswitch = in.switches[in.nextSwitch++].payload[0];
+	}
+	for(unsigned int n = 0; n < context->digitalFrames; n++)
+	{
+		if(in.footswitch)
+			context->digital[n] |= 1u << (16 + P8_08);
+		else
+			context->digital[n] &= ~(1u << (16 + P8_08));
+	}
+	while(in.nextParams < in.params.size() && in.params[in.nextParams].sample <= blockStart)
+	{
+		const JournalEntry& e = in.params[in.nextParams++];
+		if(!publishParams(&e.payload[0], e.payload.size()))
+			fprintf(stderr, "The parameters at %llu are from a different build, left out\n", (unsigned long long)e.sample);
+	}
+	uint64_t firstFrame = blockStart * in.analogFrames / in.audioFrames;
+	for(unsigned int n = 0; n < context->analogFrames; n++)
+	{
+		uint64_t frame = firstFrame + n;
+		while(in.nextOnset + 1 < in.onsets.size() && in.onsets[in.nextOnset + 1].frame <= frame)
+		{
+			in.nextOnset++;
+		}
+		float piezo = 0;
+		if(in.nextOnset < in.onsets.size() && in.onsets[in.nextOnset].frame <= frame)
+		{
+			const JournalOnset& o = in.onsets[in.nextOnset];
+			if(frame - o.frame < o.window.size())
+				piezo = o.window[frame - o.frame];
+			else if(frame < o.release)
+				piezo = o.peak;
+		}
+		context->analogIn[n * context->analogInChannels + 6] = piezo;
+	}
+}
+
+// What the tracker did, for comparing two journals.
+static bool compared(int type)
+{
+	return type != JOURNAL_HEADER && type != JOURNAL_PARAMS && type != JOURNAL_RESTORED && type != JOURNAL_DROPPED;
+}
+
+static int replay(const char* path, const std::vector<JournalEntry>& entries, bool verbose, const char* keep)
+{
+	JournalInputs in;
+	uint32_t header[5];
+	memcpy(header, &entries[0].payload[0], sizeof(header));
+	float rate;
+	memcpy(&rate, &header[2], 4);
+	in.audioFrames = header[3];
+	in.analogFrames = header[4];
+	in.nextSwitch = in.nextParams = in.nextOnset = 0;
+	in.footswitch = 1;
+
+	char snapshot[] = "/tmp/journalsnapshotXXXXXX";
+	char replayPath[] = "/tmp/journalreplayXXXXXX";
+	close(mkstemp(replayPath));
+	const char* snapshotFile = 0;
+	bool setupParams = true;
+	size_t dropped = 0;
+	for(size_t i = 1; i < entries.size(); i++)
+	{
+		const JournalEntry& e = entries[i];
+		if(e.type == JOURNAL_PARAMS)
+		{
+			if(!setupParams) // The first is what setup() started with, which the replay's setup() does too.
+				in.params.push_back(e);
+			setupParams = false;
+		}
+		else if(e.type == JOURNAL_SWITCH)
+			in.switches.push_back(e);
+		else if(e.type == JOURNAL_ONSET)
+		{
+			JournalOnset o;
+			o.frame = e.sample * in.analogFrames / in.audioFrames;
+			o.release = ~0ull;
+			o.window.resize(e.payload.size() / 4 - 1);
+			memcpy(&o.window[0], &e.payload[4], o.window.size() * 4);
+			o.peak = *std::max_element(o.window.begin(), o.window.end());
+			in.onsets.push_back(o);
+		}
+		else if(e.type == JOURNAL_RELEASE && !in.onsets.empty())
+			in.onsets.back().release = e.sample * in.analogFrames / in.audioFrames;
+		else if(e.type == JOURNAL_RESTORED)
+		{
+			uint32_t version;
+			memcpy(&version, &e.payload[0], 4);
+			SnapshotFile f;
+			close(mkstemp(snapshot));
+			if(openSnapshot(f, snapshot) && writeSnapshot(f, version, &e.payload[8], e.payload.size() - 8))
+			{
+				snapshotFile = snapshot;
+				snapshotResume = e.payload[4];
+			}
+			closeSnapshot(f);
+		}
+		else if(e.type == JOURNAL_DROPPED)
+			dropped++;
+	}
+	if(dropped)
+		printf("%s dropped records %zu times, the replay will differ after the first\n", path, dropped);
+
+	Recording silence; // The piezo comes from journalInput(), this just sets the length.
+	uint64_t end = entries.back().sample;
+	silence.times.push_back(0);
+	silence.values.push_back(0);
+	silence.times.push_back((end - 0.5) / rate);
+	silence.values.push_back(0);
+	ReplayOptions options;
+	options.audioFrames = in.audioFrames;
+	options.audioSampleRate = rate;
+	options.analogChannels = in.analogFrames == in.audioFrames ? 4 : 8;
+	options.verbose = verbose;
+	options.snapshot = snapshotFile;
+	options.journal = keep ? keep : replayPath;
+	options.input = journalInput;
+	options.inputData = &in;
+	ReplayResult result;
+	struct timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool ran = runReplay(silence, options, result);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	if(snapshotFile)
+		unlink(snapshotFile);
+	std::vector<JournalEntry> again;
+	bool read = ran && readJournal(options.journal, again);
+	if(!keep)
+		unlink(replayPath);
+	if(!read)
+	{
+		fprintf(stderr, "The replay didn't run\n");
+		return 2;
+	}
+	double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+	printf("%.1f s of session replayed in %.2f s (%.0fx real time), %zu onsets\n", end / rate, seconds,
+		end / rate / seconds, in.onsets.size());
+
+	size_t a = 0, b = 0, matched = 0;
+	while(true)
+	{
+		while(a < entries.size() && !compared(entries[a].type))
+			a++;
+		while(b < again.size() && !compared(again[b].type))
+			b++;
+		if(a == entries.size() || b == again.size())
+			break;
+		const JournalEntry& x = entries[a];
+		const JournalEntry& y = again[b];
+		if(x.type != y.type || x.sample != y.sample || x.payload != y.payload)
+		{
+			printf("DIFFERENT after %zu records, the session has\n", matched);
+			dumpEntry(x, rate);
+			printf("and the replay has\n");
+			dumpEntry(y, rate);
+			if(x.type == y.type && x.payload.size() == y.payload.size())
+			{
+				size_t byte = std::mismatch(x.payload.begin(), x.payload.end(), y.payload.begin()).first - x.payload.begin();
+				if(byte < x.payload.size())
+					printf("(first different at payload byte %zu: %d and %d)\n", byte, x.payload[byte], y.payload[byte]);
+			}
+			return 1;
+		}
+		matched++;
+		a++;
+		b++;
+	}
+	if(a != entries.size() || b != again.size())
+	{
+		printf("DIFFERENT: the %s ends after %zu matching records\n", a == entries.size() ? "session" : "replay", matched);
+		return 1;
+	}
+	printf("SAME: %zu records\n", matched);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc < 3 || (strcmp(argv[1], "dump") && strcmp(argv[1], "replay")))
+	{
+		printf("Usage: %s dump journal\n       %s replay journal [--verbose] [--keep replay.pj]\n", argv[0], argv[0]);
+		return 2;
+	}
+	bool verbose = false;
+	const char* keep = 0;
+	for(int i = 3; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--verbose"))
+			verbose = true;
+		else if(!strcmp(argv[i], "--keep") && i + 1 < argc)
+			keep = argv[++i];
+	}
+	std::vector<JournalEntry> entries;
+	if(!readJournal(argv[2], entries))
+		return 2;
+	if(!strcmp(argv[1], "dump"))
+	{
+		dump(entries);
+		return 0;
+	}
+	return replay(argv[2], entries, verbose, keep);
+}
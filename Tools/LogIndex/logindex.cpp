@@ -0,0 +1,129 @@
+/*
+ Builds and queries the time index of the Earlier_Dev logs (see Tools/Host/SensorLog.h).
+ With no logs given it indexes every .txt log under Earlier_Dev. Indexes that are already up to date
+ are only mapped, so a second run over the whole archive costs next to nothing.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -ITools/Host Tools/Host/SensorLog.cpp Tools/LogIndex/logindex.cpp -o logindex
+	./logindex [--index directory] [--threads n] [log ...]	index the logs and say what was found in them
+	./logindex --range from to [--print] [log ...]		rows with from <= time < to in each log
+ The index directory defaults to .logindex (ignored by git).
+*/
+#include "SensorLog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ftw.h>
+#include <string>
+#include <vector>
+
+static std::vector<std::string> archive;
+
+static int addLog(const char* path, const struct stat* st, int type, struct FTW* ftw)
+{
+	size_t length = strlen(path);
+	if(type == FTW_F && length > 4 && !strcmp(path + length - 4, ".txt"))
+	{
+		archive.push_back(path);
+	}
+	return 0;
+}
+
+static double secondsSince(const struct timespec& start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* indexDirectory = ".logindex";
+	int threads = 0;
+	bool query = false;
+	bool print = false;
+	float from = 0;
+	float to = 0;
+	std::vector<std::string> logs;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--index") && i + 1 < argc)
+			indexDirectory = argv[++i];
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--range") && i + 2 < argc)
+		{
+			query = true;
+			from = atof(argv[++i]);
+			to = atof(argv[++i]);
+		}
+		else if(!strcmp(argv[i], "--print"))
+			print = true;
+		else if(argv[i][0] == '-')
+		{
+			printf("Usage: %s [--index directory] [--threads n] [--range from to [--print]] [log ...]\n", argv[0]);
+			return 2;
+		}
+		else
+			logs.push_back(argv[i]);
+	}
+	if(logs.empty())
+	{
+		nftw("Earlier_Dev", addLog, 16, FTW_PHYS);
+		logs = archive;
+	}
+
+	int failed = 0;
+	size_t totalRows = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(size_t l = 0; l < logs.size(); l++)
+	{
+		struct timespec logStart;
+		clock_gettime(CLOCK_MONOTONIC, &logStart);
+		LogIndex index;
+		if(!index.open(logs[l].c_str(), indexDirectory, threads))
+		{
+			printf("%-60s can't be read\n", logs[l].c_str());
+			failed++;
+			continue;
+		}
+		totalRows += index.size();
+
+		if(!query)
+		{
+			printf("%-60s %-11s %7zu rows  %u channels  %s %.1f ms\n", logs[l].c_str(),
+				index.format() == LOG_PREDICTIONS ? "predictions" : "sensor", index.size(), index.numChannels(),
+				index.rebuilt() ? "built " : "mapped", secondsSince(logStart) * 1000);
+			printf("	%s\n", index.layout().c_str());
+			if(index.format() == LOG_PREDICTIONS)
+			{
+				printf("	labels:");
+				for(unsigned int i = 0; i < index.numLabels(); i++)
+					printf(" %s", index.label(i));
+				printf("\n");
+			}
+			continue;
+		}
+
+		size_t first;
+		size_t last;
+		index.range(from, to, first, last);
+		printf("%-60s rows %zu to %zu (%zu)  %.1f us\n", logs[l].c_str(), first, last, last - first, secondsSince(logStart) * 1e6);
+		for(size_t r = first; print && r < last; r++)
+		{
+			printf("	%.4f", index.times()[r]);
+			for(unsigned int c = 0; c < index.numChannels(); c++)
+			{
+				if(index.format() == LOG_PREDICTIONS)
+					printf("	%s", index.label(index.channel(c)[r]));
+				else
+					printf("	%.4f", index.channel(c)[r]);
+			}
+			printf("\n");
+		}
+	}
+	printf("%zu logs, %zu rows, %.1f ms\n", logs.size() - failed, totalRows, secondsSince(start) * 1000);
+	return failed ? 1 : 0;
+}
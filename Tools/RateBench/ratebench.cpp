@@ -0,0 +1,225 @@
+/*
+ Rate and block size benchmark: the same performance replayed through render.cpp at every audio rate, analog
+ channel count and block size in the matrix, to check that nothing in the engine assumes the Bela's usual
+ 44.1 kHz, 8 channels and 16 frames, and to see what each setting costs per block.
+ The performance is a steady synthetic drummer (Tools/Host/Performance.h) with a little jitter, replayed in
+ TRACK_MODE. For every setting:
+	tracker	the tracker's bpm at the end, against the drummer's.
+	clock	the bpm the Midi clock actually ran at, from the spacing of the last CLOCK_BEATS beats of pulses
+		(24 a beat). The synchroniser nudges it, so it can sit a little off the tracker's.
+	phase	RMS distance (ms) from the kicks in the second half to the nearest eighth note of the clock grid,
+		so onset times that were worked out at the wrong rate show up even if the tempo is right.
+	render	mean and worst render() cost per block and the mean per audio frame, in PROFILE_UNITS.
+ A setting fails if the tracker or the clock is more than BPM_TOLERANCE off the drummer or the phase
+ error is over PHASE_LIMIT.
+ The piezo is on analog input PIEZO_CHANNEL, so the 4 channel rows (analog at the audio rate) are only run
+ when both this and render.cpp are built with -DPIEZO_CHANNEL=2 (or lower).
+ Each replay is its own process (render.cpp's state is global), run one after another so the timings don't
+ compete for a core.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -I. -ITools/Host render.cpp Tools/Host/Host.cpp Tools/Host/Replay.cpp Tools/Host/SensorLog.cpp Tools/Host/Performance.cpp Tools/RateBench/ratebench.cpp -o ratebench
+	./ratebench [--bpm 120] [--bars 32] [--seed 1]
+ To compare with an earlier revision, build the same way from "git show <revision>:render.cpp > old_render.cpp".
+*/
+#include "Replay.h"
+#include "Performance.h"
+#include "StageProfiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PIEZO_RATE 4000.f // Hz, as Tools/Fuzz.
+#define PIEZO_DECAY 15.f // ms
+#define PIEZO_NOISE 0.02f
+#define CLOCK_BEATS 16
+#define BPM_TOLERANCE 0.01f // fraction of the drummer's bpm.
+#define PHASE_LIMIT 10.f // ms
+#define MAX_ANALOG_FRAMES 128 // render.cpp's limit on analog frames per block.
+#ifndef PIEZO_CHANNEL
+#define PIEZO_CHANNEL 6 // as render.cpp.
+#endif
+
+extern StageHistogram renderProfile; // render.cpp
+
+const float audioRates[] = {44100, 48000};
+const unsigned int analogChannelCounts[] = {8, 4};
+const unsigned int blockSizes[] = {8, 16, 32, 64, 128};
+
+const Humanize steadyHumanize = {
+	3.f, // jitterMs
+	0.f, // driftMs
+	0.f, // driftLimitMs
+	0.f, // fillRate
+	0.f, // missRate
+	0.f, // extraRate
+	1 // seed
+};
+
+struct RateResult
+{
+	int ok; // 0 if the replay didn't run.
+	float endBpm;
+	float clockBpm; // 0 if there weren't enough pulses.
+	float phaseRms; // ms
+	double meanCost; // per block
+	uint32_t maxCost;
+};
+
+static RateResult bench(const Recording& recording, const std::vector<Hit>& hits, const ReplayOptions& options)
+{
+	RateResult r = {0, 0, 0, 0, 0, 0};
+	ReplayResult result;
+	if(!runReplay(recording, options, result) || result.bpm.empty())
+		return r;
+	r.ok = 1;
+	r.endBpm = result.bpm.back().bpm;
+	if(renderProfile.count)
+		r.meanCost = (double)renderProfile.total / renderProfile.count;
+	r.maxCost = renderProfile.max;
+
+	// Clock pulses (s) since the last Start.
+	std::vector<double> pulses;
+	for(size_t i = 0; i < result.midi.size(); i++)
+	{
+		if(result.midi[i].byte == 250)
+			pulses.clear();
+		else if(result.midi[i].byte == 248)
+			pulses.push_back(result.midi[i].sample / options.audioSampleRate);
+	}
+	if(pulses.size() > 24 * CLOCK_BEATS)
+	{
+		double span = pulses.back() - pulses[pulses.size() - 1 - 24 * CLOCK_BEATS];
+		r.clockBpm = 60.0 * CLOCK_BEATS / span;
+	}
+
+	// Kicks in the second half against the eighth note grid.
+	double sum = 0;
+	int count = 0;
+	size_t g = 0;
+	double from = hits.back().time / 2;
+	for(size_t i = 0; i < hits.size() && pulses.size() > 12; i++)
+	{
+		if(hits[i].time < from || hits[i].time < pulses.front() || hits[i].time > pulses.back())
+			continue;
+		while(g + 12 < pulses.size() && pulses[g + 12] <= hits[i].time)
+			g += 12;
+		double before = hits[i].time - pulses[g];
+		double after = g + 12 < pulses.size() ? pulses[g + 12] - hits[i].time : 1e9;
+		double error = (before < after ? before : after) * 1000;
+		sum += error * error;
+		count++;
+	}
+	r.phaseRms = count ? sqrt(sum / count) : 0;
+	return r;
+}
+
+int main(int argc, char* argv[])
+{
+	float bpm = 120;
+	int bars = 32;
+	uint64_t seed = 1;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--bpm") && i + 1 < argc)
+			bpm = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--bars") && i + 1 < argc)
+			bars = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--seed") && i + 1 < argc)
+			seed = strtoull(argv[++i], 0, 10);
+		else
+		{
+			fprintf(stderr, "usage: %s [--bpm 120] [--bars 32] [--seed 1]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	TempoMap map;
+	map.startBpm = bpm;
+	map.beatsPerBar = 4;
+	map.bars = bars;
+	TempoCheckpoint steady = {0, 0.f, FEEL_STRAIGHT};
+	map.checkpoints.push_back(steady);
+	Humanize humanize = steadyHumanize;
+	humanize.seed = seed;
+	std::vector<Hit> hits;
+	generatePerformance(map, humanize, hits);
+	if(hits.empty())
+	{
+		fprintf(stderr, "no hits at %.1f bpm over %d bars\n", bpm, bars);
+		return 2;
+	}
+	Recording recording;
+	renderPiezo(hits, PIEZO_RATE, PIEZO_DECAY, PIEZO_NOISE, seed, recording);
+
+	printf("%.1f bpm, %d bars, %zu kicks, render cost in %s\n", bpm, bars, hits.size(), PROFILE_UNITS);
+	printf("%-6s %-7s %-6s  %-8s %-8s %-9s  %-10s %-10s %-9s\n", "rate", "analog", "block", "tracker", "clock",
+		"phase ms", "mean/block", "max/block", "mean/frame");
+	int failed = 0;
+	for(size_t a = 0; a < sizeof(audioRates) / sizeof(audioRates[0]); a++)
+	{
+		for(size_t c = 0; c < sizeof(analogChannelCounts) / sizeof(analogChannelCounts[0]); c++)
+		{
+			for(size_t b = 0; b < sizeof(blockSizes) / sizeof(blockSizes[0]); b++)
+			{
+				ReplayOptions options;
+				options.audioSampleRate = audioRates[a];
+				options.analogChannels = analogChannelCounts[c];
+				options.audioFrames = blockSizes[b];
+				options.piezoChannel = PIEZO_CHANNEL;
+				if(options.analogChannels <= PIEZO_CHANNEL)
+				{
+					if(b == 0)
+						printf("%-6.0f %-7u piezo on input %d, skipped\n", options.audioSampleRate, options.analogChannels, PIEZO_CHANNEL);
+					continue;
+				}
+				if((options.analogChannels == 8 ? options.audioFrames / 2 : options.audioFrames) > MAX_ANALOG_FRAMES)
+					continue;
+
+				int fds[2];
+				if(pipe(fds) != 0)
+					return 2;
+				fflush(stdout);
+				pid_t pid = fork();
+				if(pid == 0)
+				{
+					close(fds[0]);
+					RateResult r = bench(recording, hits, options);
+					ssize_t written = write(fds[1], &r, sizeof(r));
+					_exit(written == sizeof(r) ? 0 : 2);
+				}
+				close(fds[1]);
+				RateResult r = {0, 0, 0, 0, 0, 0};
+				if(pid < 0 || read(fds[0], &r, sizeof(r)) != sizeof(r))
+					r.ok = 0;
+				close(fds[0]);
+				if(pid > 0)
+					waitpid(pid, 0, 0);
+
+				printf("%-6.0f %-7u %-6u  ", options.audioSampleRate, options.analogChannels, options.audioFrames);
+				if(!r.ok)
+				{
+					printf("replay failed\n");
+					failed++;
+					continue;
+				}
+				const char* failure = 0;
+				if(fabs(r.endBpm - bpm) > BPM_TOLERANCE * bpm)
+					failure = "TEMPO";
+				else if(fabs(r.clockBpm - bpm) > BPM_TOLERANCE * bpm)
+					failure = "CLOCK";
+				else if(r.phaseRms > PHASE_LIMIT)
+					failure = "PHASE";
+				printf("%-8.2f %-8.2f %-9.2f  %-10.0f %-10u %-9.1f %s\n", r.endBpm, r.clockBpm, r.phaseRms, r.meanCost,
+					r.maxCost, r.meanCost / options.audioFrames, failure ? failure : "");
+				failed += failure != 0;
+			}
+		}
+	}
+	printf("%d failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,354 @@
+/*
+ Golden trajectory regression suite for the tracker.
+ Every recording in Earlier_Dev that has a piezo channel is replayed through render.cpp (see
+ Tools/Host/Replay.h) and the bpm trajectory, beat grid and Midi byte stream are checked against
+ the golden files in Tools/Regression/golden. Each replay runs in its own process, all at once.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -ITools/Host render.cpp Tools/Host/Host.cpp Tools/Host/Replay.cpp Tools/Host/SensorLog.cpp Tools/Regression/regression.cpp -o regression
+	./regression            check against the golden files
+	./regression --update   rewrite the golden files (after an intended change in tracking)
+
+ Golden file layout (little endian): "PULSEGLD", version, total samples, then the bpm points,
+ beats and Midi bytes, each list as a count followed by entries whose sample times are stored
+ as varint deltas from the previous entry.
+*/
+#include "Replay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define GOLDEN_VERSION 1
+#define BPM_TOLERANCE 0.05f // bpm
+#define SAMPLE_TOLERANCE 32 // samples (two blocks at -p 16)
+
+struct RegressionJob
+{
+	const char* golden; // file name in the golden directory.
+	const char* recording;
+	int footswitch; // 1 = TRACK_MODE, 0 = TAP_MODE.
+};
+
+const RegressionJob jobs[] = {
+	{"comparison_track.golden", "Earlier_Dev/Comparison_Test/Piezo(Comparison_Study).txt", 1},
+	{"comparison_tap.golden", "Earlier_Dev/Comparison_Test/Piezo(Comparison_Study).txt", 0},
+	{"c1a_track.golden", "Earlier_Dev/Sensors-_OSC/C1a_PiezoCSV.txt", 1},
+	{"c1a_tap.golden", "Earlier_Dev/Sensors-_OSC/C1a_PiezoCSV.txt", 0},
+};
+const int numJobs = sizeof(jobs) / sizeof(jobs[0]);
+
+// %%%%%%%%%%%% GOLDEN FILE ENCODING %%%%%%%%%%%%%%%%%
+
+static void putVarint(std::vector<unsigned char>& out, uint64_t value)
+{
+	while(value >= 0x80)
+	{
+		out.push_back((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out.push_back(value);
+}
+
+static void putBytes(std::vector<unsigned char>& out, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	out.insert(out.end(), bytes, bytes + size);
+}
+
+class Reader
+{
+public:
+	Reader(const std::vector<unsigned char>& d) : data(d), pos(0), ok(true) {}
+	uint64_t varint()
+	{
+		uint64_t value = 0;
+		for(int shift = 0; shift < 64; shift += 7)
+		{
+			if(pos >= data.size())
+			{
+				ok = false;
+				return 0;
+			}
+			unsigned char b = data[pos++];
+			value |= (uint64_t)(b & 0x7f) << shift;
+			if(!(b & 0x80))
+				break;
+		}
+		return value;
+	}
+	void bytes(void* dest, size_t size)
+	{
+		if(pos + size > data.size())
+		{
+			ok = false;
+			memset(dest, 0, size);
+			return;
+		}
+		memcpy(dest, &data[pos], size);
+		pos += size;
+	}
+	const std::vector<unsigned char>& data;
+	size_t pos;
+	bool ok;
+};
+
+static std::vector<unsigned char> encodeGolden(const ReplayResult& result)
+{
+	std::vector<unsigned char> out;
+	putBytes(out, "PULSEGLD", 8);
+	putVarint(out, GOLDEN_VERSION);
+	putVarint(out, result.samples);
+
+	uint64_t last = 0;
+	putVarint(out, result.bpm.size());
+	for(size_t i = 0; i < result.bpm.size(); i++)
+	{
+		putVarint(out, result.bpm[i].sample - last);
+		putBytes(out, &result.bpm[i].bpm, sizeof(float));
+		last = result.bpm[i].sample;
+	}
+
+	last = 0;
+	putVarint(out, result.beats.size());
+	for(size_t i = 0; i < result.beats.size(); i++)
+	{
+		putVarint(out, result.beats[i].sample - last);
+		signed char pos = result.beats[i].beatPos;
+		putBytes(out, &pos, 1);
+		last = result.beats[i].sample;
+	}
+
+	last = 0;
+	putVarint(out, result.midi.size());
+	for(size_t i = 0; i < result.midi.size(); i++)
+	{
+		putVarint(out, result.midi[i].sample - last);
+		out.push_back(result.midi[i].byte);
+		last = result.midi[i].sample;
+	}
+	return out;
+}
+
+static bool decodeGolden(const std::vector<unsigned char>& data, ReplayResult& result)
+{
+	Reader in(data);
+	char magic[8];
+	in.bytes(magic, 8);
+	if(memcmp(magic, "PULSEGLD", 8) || in.varint() != GOLDEN_VERSION)
+	{
+		return false;
+	}
+	result.samples = in.varint();
+
+	uint64_t sample = 0;
+	size_t count = in.varint();
+	result.bpm.resize(in.ok ? count : 0);
+	for(size_t i = 0; i < result.bpm.size() && in.ok; i++)
+	{
+		sample += in.varint();
+		result.bpm[i].sample = sample;
+		in.bytes(&result.bpm[i].bpm, sizeof(float));
+	}
+
+	sample = 0;
+	count = in.varint();
+	result.beats.resize(in.ok ? count : 0);
+	for(size_t i = 0; i < result.beats.size() && in.ok; i++)
+	{
+		sample += in.varint();
+		signed char pos;
+		in.bytes(&pos, 1);
+		result.beats[i].sample = sample;
+		result.beats[i].beatPos = pos;
+	}
+
+	sample = 0;
+	count = in.varint();
+	result.midi.resize(in.ok ? count : 0);
+	for(size_t i = 0; i < result.midi.size() && in.ok; i++)
+	{
+		sample += in.varint();
+		result.midi[i].sample = sample;
+		in.bytes(&result.midi[i].byte, 1);
+	}
+	return in.ok && in.pos == data.size();
+}
+
+static bool readFile(const std::string& path, std::vector<unsigned char>& data)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if(!file)
+		return false;
+	unsigned char buffer[65536];
+	size_t n;
+	while((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		data.insert(data.end(), buffer, buffer + n);
+	}
+	fclose(file);
+	return true;
+}
+
+static bool writeFile(const std::string& path, const std::vector<unsigned char>& data)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if(!file)
+		return false;
+	bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+	return fclose(file) == 0 && ok;
+}
+
+// %%%%%%%%%%%% COMPARISON %%%%%%%%%%%%%%%%%
+
+static bool closeInTime(uint64_t a, uint64_t b)
+{
+	return (a > b ? a - b : b - a) <= SAMPLE_TOLERANCE;
+}
+
+// Each check prints the first place the run leaves the golden trajectory.
+static bool compareBpm(const char* name, const std::vector<BpmPoint>& golden, const std::vector<BpmPoint>& run)
+{
+	for(size_t i = 0; i < golden.size() && i < run.size(); i++)
+	{
+		if(!closeInTime(golden[i].sample, run[i].sample) || fabsf(golden[i].bpm - run[i].bpm) > BPM_TOLERANCE || isnan(run[i].bpm))
+		{
+			printf("%s: bpm point %zu is %.3f at %llu, golden %.3f at %llu\n", name, i,
+				run[i].bpm, (unsigned long long)run[i].sample, golden[i].bpm, (unsigned long long)golden[i].sample);
+			return false;
+		}
+	}
+	if(golden.size() != run.size())
+	{
+		printf("%s: %zu bpm points, golden has %zu\n", name, run.size(), golden.size());
+		return false;
+	}
+	return true;
+}
+
+static bool compareBeats(const char* name, const std::vector<BeatPoint>& golden, const std::vector<BeatPoint>& run)
+{
+	for(size_t i = 0; i < golden.size() && i < run.size(); i++)
+	{
+		if(!closeInTime(golden[i].sample, run[i].sample) || golden[i].beatPos != run[i].beatPos)
+		{
+			printf("%s: beat %zu is position %d at %llu, golden %d at %llu\n", name, i,
+				run[i].beatPos, (unsigned long long)run[i].sample, golden[i].beatPos, (unsigned long long)golden[i].sample);
+			return false;
+		}
+	}
+	if(golden.size() != run.size())
+	{
+		printf("%s: %zu beats, golden has %zu\n", name, run.size(), golden.size());
+		return false;
+	}
+	return true;
+}
+
+static bool compareMidi(const char* name, const std::vector<HostMidiEvent>& golden, const std::vector<HostMidiEvent>& run)
+{
+	for(size_t i = 0; i < golden.size() && i < run.size(); i++)
+	{
+		if(!closeInTime(golden[i].sample, run[i].sample) || golden[i].byte != run[i].byte)
+		{
+			printf("%s: midi byte %zu is %d at %llu, golden %d at %llu\n", name, i,
+				run[i].byte, (unsigned long long)run[i].sample, golden[i].byte, (unsigned long long)golden[i].sample);
+			return false;
+		}
+	}
+	if(golden.size() != run.size())
+	{
+		printf("%s: %zu midi bytes, golden has %zu\n", name, run.size(), golden.size());
+		return false;
+	}
+	return true;
+}
+
+// Runs in the child process. Exit status 0 = pass, 1 = differs from golden, 2 = couldn't run.
+static int runJob(const RegressionJob& job, const std::string& goldenDir, bool update)
+{
+	Recording recording;
+	if(!loadRecording(job.recording, recording))
+		return 2;
+
+	ReplayOptions options;
+	options.footswitch = job.footswitch;
+	ReplayResult result;
+	if(!runReplay(recording, options, result))
+		return 2;
+
+	std::string path = goldenDir + "/" + job.golden;
+	if(update)
+	{
+		if(!writeFile(path, encodeGolden(result)))
+		{
+			printf("%s: can't write %s\n", job.golden, path.c_str());
+			return 2;
+		}
+		printf("%s: written (%zu bpm points, %zu beats, %zu midi bytes)\n", job.golden, result.bpm.size(), result.beats.size(), result.midi.size());
+		return 0;
+	}
+
+	std::vector<unsigned char> data;
+	ReplayResult golden;
+	if(!readFile(path, data) || !decodeGolden(data, golden))
+	{
+		printf("%s: missing or unreadable golden file, run with --update\n", job.golden);
+		return 2;
+	}
+
+	bool pass = compareBpm(job.golden, golden.bpm, result.bpm);
+	pass = compareBeats(job.golden, golden.beats, result.beats) && pass;
+	pass = compareMidi(job.golden, golden.midi, result.midi) && pass;
+	return pass ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+	bool update = false;
+	std::string goldenDir = "Tools/Regression/golden";
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--update"))
+			update = true;
+		else if(!strcmp(argv[i], "--golden") && i + 1 < argc)
+			goldenDir = argv[++i];
+		else
+		{
+			printf("Usage: %s [--update] [--golden directory]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	// One process per job, because render.cpp's state is global.
+	pid_t pids[numJobs];
+	for(int j = 0; j < numJobs; j++)
+	{
+		fflush(stdout);
+		pids[j] = fork();
+		if(pids[j] == 0)
+		{
+			int status = runJob(jobs[j], goldenDir, update);
+			fflush(stdout);
+			_exit(status);
+		}
+	}
+
+	int failed = 0;
+	for(int j = 0; j < numJobs; j++)
+	{
+		int status = 2;
+		if(pids[j] > 0 && waitpid(pids[j], &status, 0) == pids[j])
+		{
+			status = WIFEXITED(status) ? WEXITSTATUS(status) : 2;
+		}
+		printf("%-26s %s\n", jobs[j].golden, status == 0 ? "PASS" : status == 1 ? "FAIL" : "ERROR");
+		failed += status != 0;
+	}
+	printf("%d of %d passed\n", numJobs - failed, numJobs);
+	return failed ? 1 : 0;
+}
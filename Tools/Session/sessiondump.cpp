@@ -0,0 +1,90 @@
+/*
+ Lines up a recording session (see Tools/Host/Session.h) and prints it.
+ Without --csv it lists the streams and times resampling the whole session onto the grid. With --csv it
+ writes the aligned frames, one row per frame with a column per stream, ready for a spreadsheet or numpy.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -ITools/Host Tools/Host/SensorLog.cpp Tools/Host/Session.cpp Tools/Session/sessiondump.cpp -o sessiondump
+	./sessiondump [--dir Earlier_Dev/Sensors-_OSC] [--prefix C1a] [--rate 1000] [--from s] [--to s] [--csv]
+*/
+#include "Session.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double secondsSince(const struct timespec& start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* directory = "Earlier_Dev/Sensors-_OSC";
+	const char* prefix = "C1a";
+	float rate = 1000;
+	float from = 0;
+	float to = -1; // to the end.
+	bool csv = false;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--dir") && i + 1 < argc)
+			directory = argv[++i];
+		else if(!strcmp(argv[i], "--prefix") && i + 1 < argc)
+			prefix = argv[++i];
+		else if(!strcmp(argv[i], "--rate") && i + 1 < argc)
+			rate = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--from") && i + 1 < argc)
+			from = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--to") && i + 1 < argc)
+			to = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--csv"))
+			csv = true;
+		else
+		{
+			printf("Usage: %s [--dir directory] [--prefix name] [--rate Hz] [--from s] [--to s] [--csv]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	Session session;
+	if(!session.open(directory, prefix) || rate <= 0)
+		return 1;
+	double openTime = secondsSince(start);
+	if(to < 0)
+		to = session.duration();
+	size_t frames = to > from ? (to - from) * rate + 0.5f : 0;
+
+	SessionFrame frame;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	session.resample(from, rate, frames, frame);
+	double resampleTime = secondsSince(start);
+
+	if(csv)
+	{
+		printf("time");
+		for(size_t s = 0; s < frame.names.size(); s++)
+			printf(",%s", frame.names[s].c_str());
+		printf("\n");
+		for(size_t k = 0; k < frames; k++)
+		{
+			printf("%.6f", from + k / rate);
+			for(size_t s = 0; s < frame.names.size(); s++)
+				printf(",%.6f", frame.stream(s)[k]);
+			printf("\n");
+		}
+		return 0;
+	}
+
+	for(size_t s = 0; s < session.numStreams(); s++)
+	{
+		printf("%-12s %8zu rows  %8.1f Hz\n", session.streamName(s), session.streamLength(s), session.streamRate(s));
+	}
+	printf("%zu streams, %.3f s, opened in %.2f ms, %zu frames at %.0f Hz resampled in %.2f ms\n", session.numStreams(),
+		session.duration(), openTime * 1000, frames, rate, resampleTime * 1000);
+	return 0;
+}
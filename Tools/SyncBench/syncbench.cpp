@@ -0,0 +1,169 @@
+/*
+ Synchroniser benchmark: lock time and phase error of the Midi clock against the drummer.
+ Each recording is replayed through render.cpp (Tools/Host/Replay.h) in TRACK_MODE. The onsets are found
+ in the recording itself (same thresholds and refractory time as render.cpp's defaults), so the numbers
+ only depend on the Midi the tracker sent and any revision of render.cpp can be measured the same way.
+
+ The grid is every 12th clock pulse (eighth notes) counted from the last Start byte. For each onset after
+ the Start the phase error is the distance to the nearest eighth note. Lock time is from the Start byte
+ to the first onset that begins a run of LOCK_RUN onsets all within LOCK_ERROR ms of the grid.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -pthread -I. -ITools/Host render.cpp Tools/Host/Host.cpp Tools/Host/Replay.cpp Tools/Host/SensorLog.cpp Tools/SyncBench/syncbench.cpp -o syncbench
+	./syncbench [recording ...]
+ To compare with an earlier revision, build the same way from "git show <revision>:render.cpp > old_render.cpp".
+*/
+#include "Replay.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define ONSET_THRESHOLD 0.3f
+#define RELEASE_THRESHOLD 0.05f
+#define REFRACTORY_MS 227.f // 5000 analog samples at 22.05 kHz.
+#define LOCK_ERROR 25.f // ms
+#define LOCK_RUN 8
+
+const char* defaultRecordings[] = {
+	"Earlier_Dev/Comparison_Test/Piezo(Comparison_Study).txt",
+	"Earlier_Dev/Sensors-_OSC/C1a_PiezoCSV.txt",
+};
+
+// Onset times (s) by threshold crossing with hysteresis.
+static std::vector<double> findOnsets(const Recording& recording)
+{
+	std::vector<double> onsets;
+	bool triggered = false;
+	double last = -1e9;
+	for(size_t i = 0; i < recording.values.size(); i++)
+	{
+		double t = recording.times[i];
+		if(!triggered && recording.values[i] > ONSET_THRESHOLD)
+		{
+			onsets.push_back(t);
+			triggered = true;
+			last = t;
+		}
+		else if(triggered && recording.values[i] < RELEASE_THRESHOLD && (t - last) * 1000 > REFRACTORY_MS)
+		{
+			triggered = false;
+		}
+	}
+	return onsets;
+}
+
+static int bench(const char* path)
+{
+	Recording recording;
+	if(!loadRecording(path, recording))
+		return 2;
+	ReplayOptions options;
+	ReplayResult result;
+	if(!runReplay(recording, options, result))
+		return 2;
+
+	// Eighth note grid from the Midi stream.
+	std::vector<double> grid;
+	double start = -1;
+	int pulses = 0;
+	for(size_t i = 0; i < result.midi.size(); i++)
+	{
+		double t = result.midi[i].sample / options.audioSampleRate;
+		if(result.midi[i].byte == 250)
+		{
+			start = t;
+			pulses = 0;
+			grid.clear();
+		}
+		else if(result.midi[i].byte == 248 && start >= 0)
+		{
+			if(pulses % 12 == 0)
+				grid.push_back(t);
+			pulses++;
+		}
+	}
+	if(grid.size() < 2)
+	{
+		printf("%-60s no clock after Start\n", path);
+		return 0;
+	}
+
+	std::vector<double> onsets = findOnsets(recording);
+	std::vector<double> errors;
+	std::vector<double> errorTimes;
+	size_t g = 0;
+	for(size_t i = 0; i < onsets.size(); i++)
+	{
+		if(onsets[i] < grid.front() || onsets[i] > grid.back())
+			continue;
+		while(g + 1 < grid.size() && grid[g + 1] <= onsets[i])
+			g++;
+		double before = onsets[i] - grid[g];
+		double after = g + 1 < grid.size() ? grid[g + 1] - onsets[i] : 1e9;
+		errors.push_back(before < after ? before * 1000 : -after * 1000);
+		errorTimes.push_back(onsets[i]);
+	}
+
+	int lockIndex = -1;
+	for(size_t i = 0; i + LOCK_RUN <= errors.size() && lockIndex < 0; i++)
+	{
+		bool run = true;
+		for(size_t k = i; k < i + LOCK_RUN && run; k++)
+			run = fabs(errors[k]) < LOCK_ERROR;
+		if(run)
+			lockIndex = i;
+	}
+
+	double sum = 0;
+	double lockedSum = 0;
+	int within = 0;
+	for(size_t i = 0; i < errors.size(); i++)
+	{
+		sum += errors[i] * errors[i];
+		if(lockIndex >= 0 && (int)i >= lockIndex)
+			lockedSum += errors[i] * errors[i];
+		within += fabs(errors[i]) < LOCK_ERROR;
+	}
+	int lockedCount = lockIndex >= 0 ? errors.size() - lockIndex : 0;
+
+	printf("%-60s onsets %4zu	lock ", path, errors.size());
+	if(lockIndex >= 0)
+		printf("%6.2f s", errorTimes[lockIndex] - start);
+	else
+		printf(" never  ");
+	printf("	rms %6.2f ms	rms locked %6.2f ms	within %.0f ms %5.1f%%\n",
+		errors.empty() ? 0.0 : sqrt(sum / errors.size()),
+		lockedCount ? sqrt(lockedSum / lockedCount) : 0.0,
+		LOCK_ERROR, errors.empty() ? 0.0 : 100.0 * within / errors.size());
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<const char*> paths;
+	for(int i = 1; i < argc; i++)
+		paths.push_back(argv[i]);
+	if(paths.empty())
+		paths.assign(defaultRecordings, defaultRecordings + sizeof(defaultRecordings) / sizeof(defaultRecordings[0]));
+
+	// One process per replay (render.cpp's state is global), run one after another so the output stays in order.
+	int failed = 0;
+	for(size_t i = 0; i < paths.size(); i++)
+	{
+		fflush(stdout);
+		pid_t pid = fork();
+		if(pid == 0)
+		{
+			int status = bench(paths[i]);
+			fflush(stdout);
+			_exit(status);
+		}
+		int status = 2;
+		if(pid > 0)
+			waitpid(pid, &status, 0);
+		failed += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+/*
+ Tap tempo benchmark: TapTempo.h against the mean of the last four IOIs that TAP_MODE used before it, on
+ synthetic tapping (Tools/Host/Performance.h) at steady tempos from 60 to 240 bpm. The drummer has timing
+ jitter and drift, misses --miss of the taps and adds a stray one (a sixteenth after the beat) to --extra of
+ the beats. Each run starts from a reset, so the first tap is timed from one long before it, as in render.cpp.
+ For each estimator and tempo, over all the seeds:
+	taps	taps until the estimate is within TOLERANCE of the true bpm and stays there for SETTLE taps (median)
+	within	the estimates after that which are within TOLERANCE
+	rms	bpm error of the estimates after that
+ and the cost of adding a tap and taking the estimate with StageProfiler.h's counter.
+
+ Build and run from the repository root:
+	g++ -O2 -std=c++11 -I. -ITools/Host Tools/Host/Performance.cpp Tools/TapBench/tapbench.cpp -o tapbench
+	./tapbench [--seeds 50] [--miss 0.05] [--extra 0.05]
+*/
+#include "Performance.h"
+#include "TapTempo.h"
+#include "StageProfiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#define TOLERANCE 0.03f // fraction of the bpm.
+#define SETTLE 4
+#define STALE_IOI 5000.f // ms, the first tap after a reset (RESET_MS and then some).
+#define OLD_WINDOW 4 // render.cpp's MAX_COARSE_ONSETS...
+#define OLD_MIN_TAPS 5 // ...and the taps it waited for.
+#define NEW_MIN_TAPS 4 // render.cpp's TAP_MIN_TAPS.
+
+struct Score
+{
+	std::vector<int> taps;
+	int estimates;
+	int within;
+	double squared;
+	int unsettled; // runs that never settled.
+};
+
+// The old estimator, as render.cpp had it: the sum of a four slot ring over the taps so far (up to four).
+struct OldTapTempo
+{
+	float ring[OLD_WINDOW];
+	int index;
+	int taps;
+};
+
+static float oldEstimate(OldTapTempo& t, float ioi)
+{
+	t.taps++;
+	t.ring[t.index] = ioi;
+	t.index = (t.index + 1) % OLD_WINDOW;
+	float sum = 0;
+	for(int i = 0; i < OLD_WINDOW; i++)
+		sum += t.ring[i];
+	return sum / std::min(t.taps, OLD_WINDOW);
+}
+
+// Scores one run's estimates (bpm, 0 while there isn't one yet) against the true bpm of each tap.
+static void score(const std::vector<float>& estimates, const std::vector<float>& truth, Score& s)
+{
+	size_t n = estimates.size();
+	size_t settled = n;
+	for(size_t i = 0; i + SETTLE <= n && settled == n; i++)
+	{
+		size_t k = i;
+		while(k < i + SETTLE && estimates[k] > 0 && fabsf(estimates[k] - truth[k]) <= TOLERANCE * truth[k])
+			k++;
+		if(k == i + SETTLE)
+			settled = i;
+	}
+	if(settled == n)
+	{
+		s.unsettled++;
+		return;
+	}
+	s.taps.push_back(settled + 1);
+	for(size_t i = settled; i < n; i++)
+	{
+		float error = estimates[i] - truth[i];
+		s.estimates++;
+		s.within += fabsf(error) <= TOLERANCE * truth[i];
+		s.squared += error * error;
+	}
+}
+
+static void print(const char* name, Score& s)
+{
+	std::sort(s.taps.begin(), s.taps.end());
+	if(s.taps.empty())
+	{
+		printf("  %-5s never settled", name);
+		return;
+	}
+	printf("  %-5s %3d taps %5.1f%% %6.2f bpm", name, s.taps[s.taps.size() / 2], 100.0 * s.within / s.estimates,
+		sqrt(s.squared / s.estimates));
+	if(s.unsettled)
+		printf(" (%d unsettled)", s.unsettled);
+}
+
+int main(int argc, char* argv[])
+{
+	int seeds = 50;
+	float miss = 0.05f;
+	float extra = 0.05f;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--seeds") && i + 1 < argc)
+			seeds = std::max(1, atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--miss") && i + 1 < argc)
+			miss = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--extra") && i + 1 < argc)
+			extra = atof(argv[++i]);
+		else
+		{
+			printf("Usage: %s [--seeds n] [--miss rate] [--extra rate]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	uint32_t overhead = ~0u;
+	for(int i = 0; i < 1000; i++)
+	{
+		uint32_t start = readCycleCounter();
+		overhead = std::min(overhead, readCycleCounter() - start);
+	}
+	std::vector<uint32_t> costs;
+	TapTempo tapTempo;
+
+	printf("  bpm         taps to settle, estimates within %.0f%% and rms error after that\n", TOLERANCE * 100);
+	for(float bpm = 60; bpm <= 240; bpm += 20)
+	{
+		Score oldScore = {};
+		Score newScore = {};
+		for(int seed = 1; seed <= seeds; seed++)
+		{
+			TempoMap map;
+			map.startBpm = bpm;
+			map.beatsPerBar = 4;
+			map.bars = 8;
+			Humanize humanize = {10.f, 2.f, 20.f, 0.f, miss, extra, (uint64_t)seed};
+			std::vector<Hit> hits;
+			generatePerformance(map, humanize, hits);
+
+			OldTapTempo old = {};
+			resetTapTempo(tapTempo);
+			std::vector<float> oldEstimates, newEstimates, truth;
+			for(size_t i = 0; i < hits.size(); i++)
+			{
+				float ioi = i == 0 ? STALE_IOI : (hits[i].time - hits[i - 1].time) * 1000;
+				float oldIOI = oldEstimate(old, ioi);
+				oldEstimates.push_back(i + 1 >= OLD_MIN_TAPS && oldIOI > 0 ? 60000 / oldIOI : 0);
+
+				uint32_t start = readCycleCounter();
+				if(i > 0)
+					addTap(tapTempo, ioi);
+				float newIOI = tapEstimate(tapTempo);
+				uint32_t cycles = readCycleCounter() - start;
+				costs.push_back(cycles > overhead ? cycles - overhead : 0);
+				newEstimates.push_back(i + 1 >= NEW_MIN_TAPS && newIOI > 0 ? 60000 / newIOI : 0);
+				truth.push_back(hits[i].bpm);
+			}
+			score(oldEstimates, truth, oldScore);
+			score(newEstimates, truth, newScore);
+		}
+		printf("%5.0f", bpm);
+		print("old", oldScore);
+		print("new", newScore);
+		printf("\n");
+	}
+	std::sort(costs.begin(), costs.end());
+	printf("TapTempo per tap: p50 %u  p99 %u  worst %u %s\n", costs[costs.size() / 2], costs[costs.size() * 99 / 100],
+		costs.back(), PROFILE_UNITS);
+	return 0;
+}
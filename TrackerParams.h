@@ -0,0 +1,62 @@
+/*
+ The tracker's parameter set: what can be retuned over OSC between songs, what goes in the journal's PARAMS
+ record and the snapshot, and the defaults render.cpp starts from (defaultParams, defined there).
+ Here rather than in render.cpp so the tools that run a part of the tracker on its own (Tools/ClassifierBench)
+ start from the same defaults and turn them into the part's own parameters the same way.
+ Change SNAPSHOT_VERSION in render.cpp whenever the struct changes.
+*/
+#ifndef TRACKER_PARAMS_H
+#define TRACKER_PARAMS_H
+
+#include "OnsetClassifier.h"
+
+#define MAX_BAR_LENGTH 16 // Longest bar in eighth notes.
+#define ONSET_SOURCE_PIEZO 0 // Where the onsets come from: the piezo on analog input PIEZO_CHANNEL...
+#define ONSET_SOURCE_AUDIO 1 // ...or an audio input (see AudioOnsetDetector.h).
+#define RETRIGGER_MS 227 // After an onset before the piezo can trigger again (what was 5000 analog frames at 22.05 kHz).
+
+struct TrackerParams
+{
+	float tempoThreshold; // starting value, the tracker adapts it from here.
+	float syncThreshold; // filtered phase error (ms) under which the synchroniser counts as locked.
+	float alpha; // system responisiveness (how fast tempo changes are made).
+	float beta; // similar to alpha but for the sync process (scales the loop gains).
+	float tempoStdDev; // starting value (ms).
+	float syncStdDev; // starting value of the RMS phase error (ms).
+	float tempoWeights[16]; // Duration in eight notes (2 is a quater note, 4 is a half note etc.)
+	int barLength; // Eighth notes in the bar (up to MAX_BAR_LENGTH).
+	float syncWeights[MAX_BAR_LENGTH]; // Eighth note beats in the bar.
+	float minBpm;
+	float maxBpm;
+	float onsetThreshold; // piezo level that counts as an onset.
+	float releaseThreshold; // piezo level it has to fall below before retriggering.
+	int glidePulses; // clock pulses to glide over when the tempo changes (0 = jump straight there).
+	float classifyWindow; // ms of piezo looked at before an onset is labelled (0 = every onset is a kick), see OnsetClassifier.h.
+	float kickPeak; // piezo peak a kick reaches.
+	float maxRise; // ms, quiet onsets rising slower than this...
+	float minDecay; // ...and losing less than this fraction of the peak in the window are bleed.
+	float bleedWindow; // ms after the retrigger holdoff (RETRIGGER_MS) that a kick can still ring on for.
+	float bleedRatio; // fraction of the kick's peak that ringing stays under.
+	int onsetSource; // ONSET_SOURCE_PIEZO or ONSET_SOURCE_AUDIO.
+	int audioChannel; // audio input the kick is on.
+	float audioCutoff; // Hz, top of the kick's band.
+	float audioGain; // scales the audio level to the piezo's, so the thresholds above work for both.
+	float audioRelease; // ms for the audio level to fall to a third after a hit.
+	int confidenceChannel; // Midi channel (0 to 15) of the confidence CC...
+	int confidenceCC; // ...and its controller number (-1 = not sent).
+};
+
+extern const TrackerParams defaultParams;
+
+// The classifier's parameters (in analog samples) from a parameter set.
+static inline void setClassifierParams(OnsetClassifierParams& c, const TrackerParams& p, float analogSampleRate)
+{
+	c.window = p.classifyWindow * analogSampleRate / 1000;
+	c.kickPeak = p.kickPeak;
+	c.maxRise = p.maxRise * analogSampleRate / 1000;
+	c.minDecay = p.minDecay;
+	c.bleedWindow = (RETRIGGER_MS + p.bleedWindow) * analogSampleRate / 1000; // Nothing crosses before the holdoff is over.
+	c.bleedRatio = p.bleedRatio;
+}
+
+#endif /* TRACKER_PARAMS_H */
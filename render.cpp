@@ -17,25 +17,94 @@ Developed on the....
 #include <Bela.h>
 #include <Midi.h>
 #include <stdlib.h>
+#include <string.h>
 #include <rtdk.h>
 #include <cmath>
 #include <fstream>
 #include <OSCServer.h>
+#include <OSCClient.h>
 #include <WriteFile.h>
+#include <atomic>
+#include "StageProfiler.h"
+#include "OnsetClassifier.h"
+#include "AudioOnsetDetector.h"
+#include "FlushToZero.h"
+#include "TimerWheel.h"
+#include "TapTempo.h"
+#include "Snapshot.h"
+#include "Journal.h"
+#include "TrackerParams.h"
+#include <time.h>
 
 #define MAX_ONSETS 8
-#define MAX_COARSE_ONSETS 4
+#define TAP_MIN_TAPS 4 // Taps before TAP_MODE sets the tempo (the first after a reset has no IOI).
 #define TRACK_MODE 1
 #define TAP_MODE 0
+#define NO_MODE -1 // Before the footswitch has been read.
+#define PLL_CAPTURE 0.25 // Capture window once locked, as a fraction of an eighth note either side of the grid.
+#define PLL_LOCK_ONSETS 4 // Onsets in a row under syncThreshold before we count as locked.
+#define PLL_MAX_MISSES 4 // Onsets in a row outside the capture window before we count as unlocked.
+#define PLL_ACQUIRE_KP 0.8 // Loop gains while acquiring (phase, then tempo).
+#define PLL_ACQUIRE_KI 0.3
+#define PLL_TRACK_KP 0.5 // Loop gains once locked.
+#define PLL_TRACK_KI 0.1
+#define PLL_MAX_DELTA 4.0 // Largest tempo correction from one onset (bpm).
+#define PLL_SLEW 0.1 // Most a phase correction can lengthen or shorten one clock pulse (fraction of the pulse spacing).
+#define DOWNBEAT_DECAY 0.9 // How much of the downbeat evidence is kept per captured onset.
+#define DOWNBEAT_MIN_ONSETS 8 // Captured onsets before the downbeat estimate is trusted.
+#define DOWNBEAT_MARGIN 1.25 // How much better another downbeat has to fit before we move the bar.
+#define GAUSSIAN_MIN_EXPONENT -80.0 // gaussianTempo() is 0 below this rather than a denormal (e^-80 is still a normal float).
+#define TEMPO_STD_DEV_MIN 1.0 // tempoStdDev is kept between these (ms), it divides the gaussian's exponent.
+#define TEMPO_STD_DEV_MAX 2000.0
+#define PE_MEAN_MIN 0.001 // ms, smallest mean performance error tempoStdDev is scaled by (perfectly even onsets have none).
+#define DEBOUNCE_MS 20 // How long the footswitch has to hold a new level before the mode changes.
+#define TELEMETRY_RATE 20 // Telemetry samples per second sent over OSC.
+#ifndef PIEZO_CHANNEL
+#define PIEZO_CHANNEL 6 // Analog input the piezo is wired to (-DPIEZO_CHANNEL=2 for a board running 4 analog channels).
+#endif
+#define MAX_ANALOG_FRAMES 128 // Largest block the audio input levels are kept for.
+#define RESET_MS 4000 // Time without an onset before the tracker starts again from scratch.
+#define CONFIDENCE_RATE 10 // Most confidence CCs per second.
+#define CONFIDENCE_SMOOTHING 0.25 // How far the confidence moves towards each onset's score.
+#define MIDI_BYTE_MS 0.32 // 10 bits at 31250 baud.
+#define SNAPSHOT_MS 2000 // How often the tracker state is saved.
+#define SNAPSHOT_RESUME_S 60 // A snapshot of a running clock younger than this restarts the slaves at setup.
+#define SNAPSHOT_VERSION 1 // Of TrackerState, change it whenever TrackerState or TrackerParams change.
+#define JOURNAL_MS 250 // How often the journal is written out.
+#define JOURNAL_MAX_WINDOW 2400 // Classifier window samples kept for the journal (50 ms at 44.1 kHz and then some).
+#define LATENCY_BUCKETS 100 // 1 ms buckets for the onset to clock correction latency, the last one catches everything above.
 
+// Control plane variables (see TimerWheel.h)
+// Everything that happens at a set time rather than on an input runs off a timer, dispatched once per block at
+// its frame: the clock pulses (which also step the eighth note grid and flash the LED), the LED off edges, the
+// telemetry and the reset after RESET_MS without an onset. Onsets and syncAdjust() move timers instead of
+// anything being counted sample by sample.
+#define TIMER_PULSE 0
+#define TIMER_LED_OFF 1
+#define TIMER_RESET 2
+#define TIMER_TELEMETRY 3
+#define TIMER_CONFIDENCE 4
+#define TIMER_SNAPSHOT 5
+#define TIMER_JOURNAL 6
+TimerWheel timerWheel;
+Timer pulseTimer = {TIMER_PULSE};
+Timer ledTimer = {TIMER_LED_OFF};
+Timer resetTimer = {TIMER_RESET};
+Timer telemetryTimer = {TIMER_TELEMETRY};
+Timer confidenceTimer = {TIMER_CONFIDENCE};
+Timer snapshotTimer = {TIMER_SNAPSHOT};
+Timer journalTimer = {TIMER_JOURNAL};
+int resetSamples; // RESET_MS in samples.
+//-------------------
 //LED variables
-bool LEDstate = false;
-bool onFlag = false;
-int LEDTimeOut = 0;
+// The LEDs are driven by edges. Each quarter note pulse writes the on edge at its frame and schedules the off
+// edge timeOutsamples later (possibly in a later block). Frames where an LED doesn't change aren't written,
+// a digitalWrite() holds until the next one.
+const int ledPins[2] = {P8_07, P8_09}; // LED for each mode, indexed by TAP_MODE / TRACK_MODE.
+int ledStates[2] = {-1, -1}; // Last level written to each LED (-1 = not written yet).
 //-------------------
 // System Status variables
-static int status=GPIO_LOW;
-static int pulseMode;
+static int pulseMode = NO_MODE; // Debounced footswitch mode, only changed by updateMode().
 //-------------------------
 // Onset, timeout and BPM adjustment variables
 bool trig = false;
@@ -43,12 +112,22 @@ bool enoughTrackTaps = false;
 bool enoughCoarseTaps = false;
 bool enoughTaps = false;
 int timeOutsamples;
-int timeOutCount = 0;
-int digitalSampleRate;
-int count;
+uint64_t retriggerFrame = 0; // Analog frame after which the piezo can trigger again.
+int retriggerFrames; // RETRIGGER_MS in analog frames.
 int tapCount = 0;
 int coarseTaps = 0;
 int sampleInterval; // miliseconds for the clock pulse (24 PPQN = Pulses per quater note)
+// Clock glide variables
+// When the tempo changes the pulse spacing glides to the new sampleInterval over params->glidePulses pulses
+// (a fixed step per pulse), and the time to the next pulse keeps its fraction of a sample, so slaves see the
+// tempo move smoothly instead of one pulse landing early or late.
+float pulseTarget; // exact samples per pulse for the current bpm.
+float pulseSpacing; // samples per pulse right now.
+float pulseCountdown; // samples from pulseOrigin until the next pulse, which is due on the frame it counts down to 0 or less.
+uint64_t pulseOrigin = 0;
+float glideStep = 0;
+int glideRemaining = 0; // pulses left in the glide.
+float phasePending = 0; // samples of syncAdjust()'s phase correction not yet spread over the pulses.
 int bpmIncrement; 
 int frames; // frames to count through so that the Bpm can be incremented every quater note.
 int tapIndex = 0;
@@ -63,48 +142,152 @@ float gSamplingPeriod = 0;
 float taps[4];
 float onsets[MAX_ONSETS];
 //--------------------------------
-// Switching Flags ################################
-bool coarseOn = false;
-bool trackOn = false;
+// Onset classifier variables (see OnsetClassifier.h)
+// Bleed is dropped, kicks and ghost notes go on to the tracker. The crossing time is kept while the window
+// fills, so the tracker still gets the onset to the frame, it just hears about it classifyWindow ms later.
+OnsetClassifier classifier = {};
+OnsetClassifierParams classifierParams;
+float analogSampleRate;
+float onsetTime; // ms, time of the crossing being classified.
+uint64_t onsetSample; // audio frame of the crossing being classified.
+unsigned int onsetCounts[3]; // onsets of each class since the last reset.
+float lastKickTime = 0.f; // ms, crossing of the last onset labelled a kick, which is what bleed rings on from.
+//--------------------------------
+// Audio input variables (see AudioOnsetDetector.h)
+// With params->onsetSource set to ONSET_SOURCE_AUDIO the detector turns the block of audio into one level per
+// analog frame before the onset loop, and the onset loop reads those levels instead of the piezo.
+AudioOnsetDetector audioDetector = {};
+AudioOnsetParams audioDetectorParams;
+float audioSampleRate;
+int audioFramesPerFrame; // audio frames to each analog frame.
+unsigned int audioInputs; // audio input channels.
+float audioLevels[MAX_ANALOG_FRAMES];
+//--------------------------------
+// Footswitch variables ################################
+int switchLevel = -1; // Last level read from P8_08.
+int switchStableSamples = 0; // How long it has held that level.
+int debounceSamples;
 //--------------------------------
 
 ///%%%%% SENSOR LOGGING VARIABLES %%%%%%%%%%%%%%%%%
-float seconds = 0.f;
 float input = 0.f;
 int measuredSamps = 0;
 //--------------------------------
 
-// Coarse Tempo variables
-bool resetFlag = false;
-int timerIndex = 0;
-int samplesSinceLastTap = 0;
-float timerArray[MAX_COARSE_ONSETS];
+// Coarse Tempo variables (see TapTempo.h)
+TapTempo tapTempo;
 float averageIOI;
-float msSinceLastTap = 0;
 // -------------------
 
 // Tempo Adjustment variables
+// The tracker state has to stay finite: a single NaN or infinity in bpm, tempoStdDev or the thresholds would stay
+// there for good (every comparison with a NaN is false, so the clamps let it through). Divisions that can meet a
+// zero are floored, and an update that still comes out non-finite is dropped, keeping the last good value.
 int durationAsEighthNotes;
 float tempoThreshold = 0.9;
 float tempoStdDev = 50;
-float alpha = 0.7; // system responisiveness (how fast tempo changes are made), I' making this 1.0 for now.
 // -------------------
 
 // Phase Sync variables
-int beatPos = -1; // initialising as -1 until enough taps are reached
-int beatOffset = 0;
-float syncThreshold;
-float syncStdDev = 50; // beggining with 50 ms.
-float beta = 1.0; // similar to alpha but for the sync process.
+// syncAdjust() is a second order phase locked loop. Each onset's phase error against the nearest eighth note of
+// the clock grid moves the clock phase (proportional path) and nudges the tempo through syncDelta (integral path,
+// bpm is the integrator). The phase moves by at most PLL_SLEW of a pulse per pulse, so the slaves never see the
+// pulses bunch up or gap, and the error is measured against where the grid will be once the move is done.
+// While acquiring it takes every onset with high gains; once the filtered error has stayed under syncThreshold
+// for PLL_LOCK_ONSETS onsets it is locked, only takes onsets inside the capture window and uses lower gains.
+// PLL_MAX_MISSES onsets outside the window, or the error drifting to twice syncThreshold, drops it back to
+// acquiring.
+int beatPos = -1; // Eighth note position in the bar, initialising as -1 until enough taps are reached
+float syncThreshold; // filtered phase error (ms) under which we count as locked.
+float syncStdDev = 50; // RMS phase error of the captured onsets (ms).
 float syncDelta;
-float discrepencies[MAX_ONSETS];
-float mostRecentMidiClickTime = 0;
-float closestMidiClickTime = 0;
+float phaseError = 0; // Most recent onset's phase error (ms, positive = onset later than the grid).
+float filteredPhaseError = 50; // Running mean of the size of the phase error (ms).
+bool syncLocked = false;
+int lockCount = 0;
+int missCount = 0;
+float onsetAccuracy = 0; // Accuracy of the winning IOI for the most recent onset (from tempoAdjust).
+float mostRecentMidiClickTime = 0; // Time of the last eighth note of the clock grid (ms).
 // -------------------
 
-// Probability Weights
-float tempoWeights[16] = {0.9, 1.0, 0.1, 1.0, 0.1, 0.1, 0.1, 0.8, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0}; // Duration in eight notes (2 is a quater note, 4 is a half note etc.)
-float syncWeights[8] = {1.0, 0.1, 1.0, 0.4, 1.0, 0.4, 1.0, 0.4}; // Eighth note beats in the bar.
+// Bar tracking variables
+// The bar is params->barLength eighth notes long and params->syncWeights holds how likely a kick is on each of them.
+// Captured onsets build up a decaying histogram of where in the bar they land. When another position fits the
+// weight table clearly better as the downbeat, the bar is moved to start there. A Song Position Pointer is sent
+// when the bar moves while locked, or on locking if it moved while acquiring (once, for where it ended up) or
+// if sync had been lost, so slave sequencers jump to the right place instead of restarting. Otherwise the
+// slaves have counted every pulse and are already in the right place.
+int barCount = 0; // Bars since the Start message.
+int downbeatOnsets = 0;
+float downbeatHistogram[MAX_BAR_LENGTH];
+bool songPositionPending = false; // Send a Song Position Pointer before the next eighth note.
+int locksSinceStart = 0;
+int barMoved = 0; // eighth notes the bar has moved while acquiring since the slaves were last told where it is.
+int songPositionGap; // samples the clock byte and Stop, SPP, Continue take on the wire.
+
+struct MeterPreset
+{
+	int numerator;
+	int denominator;
+	int barLength; // eighth notes
+	float syncWeights[MAX_BAR_LENGTH];
+};
+
+const MeterPreset meterPresets[] = {
+	{4, 4, 8, {1.0, 0.1, 1.0, 0.4, 1.0, 0.4, 1.0, 0.4}},
+	{3, 4, 6, {1.0, 0.2, 0.7, 0.3, 0.7, 0.3}},
+	{6, 8, 6, {1.0, 0.3, 0.3, 0.8, 0.3, 0.3}},
+	{7, 8, 7, {1.0, 0.3, 0.7, 0.3, 0.7, 0.3, 0.3}}, // 2 + 2 + 3
+	{2, 4, 4, {1.0, 0.2, 0.8, 0.3}},
+	{5, 4, 10, {1.0, 0.2, 0.7, 0.3, 0.7, 0.3, 0.7, 0.3, 0.7, 0.3}},
+	{12, 8, 12, {1.0, 0.3, 0.3, 0.8, 0.3, 0.3, 0.9, 0.3, 0.3, 0.8, 0.3, 0.3}},
+};
+const int numMeterPresets = sizeof(meterPresets) / sizeof(meterPresets[0]);
+// -------------------
+
+// Tracker parameters
+// These can be retuned over OSC between songs. The aux task edits stagedParams and on commit
+// copies it into its back slot, then swaps that slot with the middle one in a single atomic exchange.
+// The render thread swaps the middle slot in at the start of a block when it is flagged as fresh,
+// so it only ever reads a complete parameter set and never waits for the aux task (triple buffering).
+// The set itself is in TrackerParams.h.
+const TrackerParams defaultParams = {
+	0.9, // tempoThreshold
+	15.0, // syncThreshold
+	0.7, // alpha
+	1.0, // beta
+	50, // tempoStdDev
+	50, // syncStdDev
+	{0.9, 1.0, 0.1, 1.0, 0.1, 0.1, 0.1, 0.8, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0}, // tempoWeights
+	8, // barLength (4/4)
+	{1.0, 0.1, 1.0, 0.4, 1.0, 0.4, 1.0, 0.4}, // syncWeights
+	60.f, // minBpm
+	240.f, // maxBpm
+	0.3, // onsetThreshold
+	0.05, // releaseThreshold
+	12, // glidePulses (half a beat)
+	3.0, // classifyWindow
+	0.6, // kickPeak
+	3.0, // maxRise (the whole window, so no swells: the two quiet onsets it catches in the Comparison Study count-in are what the tracker starts from)
+	0.2, // minDecay
+	100.0, // bleedWindow
+	0.7, // bleedRatio
+	ONSET_SOURCE_PIEZO, // onsetSource
+	0, // audioChannel
+	150.0, // audioCutoff
+	4.0, // audioGain
+	10.0, // audioRelease
+	0, // confidenceChannel
+	16 // confidenceCC (General Purpose 1)
+};
+
+#define PARAMS_FRESH 4 // Flag on paramsMiddle meaning the aux task has published a set the render thread hasn't taken yet.
+TrackerParams paramSlots[3];
+TrackerParams* params = &paramSlots[0]; // The set the render thread is using (render thread only).
+int paramsFront = 0; // render thread only.
+int paramsBack = 2; // aux task only.
+std::atomic<int> paramsMiddle(1);
+TrackerParams stagedParams; // Edited by the OSC messages (aux task only).
 // -------------------
 
 // Standard Metrical Divisions (ms) 
@@ -120,14 +303,161 @@ void tempoAdjust();
 void syncAdjust();
 void calculateStandardNoteDivisions(float newBpm);
 float gaussianTempo (float error);
-float gaussianSync (float discrepency);
-void discrepencyCalculation(float timeNow);
+void resetSync();
+int updateDownbeat(int position);
+void resetDownbeat();
+bool sendSongPosition(uint64_t pulseSample);
+void updateMode(BelaContext *context);
+void enterMode(BelaContext *context, int newMode);
+void setPulseInterval();
+void setLed(BelaContext *context, int frame, int mode, int state);
+void updateLeds(BelaContext *context);
+void catchUpPulse();
+void schedulePulse();
+void clockPulse(BelaContext *context, unsigned int frame);
+void resetTracking(BelaContext *context, unsigned int frame);
+void updateConfidence();
+void sampleConfidence();
+void sendConfidence(uint64_t pulseSample);
+void restoreSnapshot();
+bool paramsFinite(const TrackerParams& p);
+void publishSnapshot();
+void snapshotCallback();
+void journalEvent(uint64_t sample, int type, const void* payload = 0, uint32_t size = 0);
+void writeMidi(uint64_t sample, midi_byte_t* bytes, unsigned int length);
+void journalCallback();
+bool publishParams(const void* data, size_t size);
+void telemetryCallback();
+void publishTelemetry(BelaContext *context);
+void oscCallback();
+void takeNewParams();
+void applyParams();
 //----------------------------------
 // Midi variables
 Midi midi;
 const char* gMidiPort0 = "hw:1,0,0";
 //----------------------------------
 
+// Confidence variables
+// How sure the tracker is of the tempo, 0 to 1: each onset in TRACK_MODE scores the accuracy of its winning IOI
+// (halved until the sync has locked) and the confidence is smoothed towards it. It goes out as a CC on the clock's
+// port for the lighting rig and anything else that should only follow the tempo when it's right.
+// confidenceTimer samples it at CONFIDENCE_RATE and only a changed value is kept, the latest replacing any not
+// sent yet. It is sent straight after a clock byte, and only if its three bytes are through the port before the
+// next one is due, so the clock bytes are never held up behind it.
+float confidence = 0;
+int confidenceSent = -1; // last CC value sent (-1 = none yet).
+int confidenceValue = 0; // waiting to be sent...
+bool confidencePending = false; // ...if this is set.
+int confidenceGap; // samples the clock byte and the CC take on the wire.
+//----------------------------------
+
+// Telemetry variables
+// The render thread copies the tracker state into telemetrySample at TELEMETRY_RATE and the
+// aux task sends it, so the OSC traffic is one message per period no matter how many onsets arrive.
+// To watch it from the laptop: "oscdump 7563" (liblo) or "nc -ul 7563".
+struct TelemetrySample
+{
+	float seconds;
+	float bpm;
+	float tempoThreshold;
+	float tempoStdDev;
+	float syncThreshold;
+	float syncDelta;
+	int beatPos;
+	float lastAccuracy; // accuracy of the latest onset in this period.
+	float meanAccuracy; // mean accuracy of all onsets in this period.
+	int onsets; // number of onsets in this period.
+};
+OSCClient telemetryClient;
+AuxiliaryTask telemetryTask;
+TelemetrySample telemetrySample;
+std::atomic<unsigned int> telemetrySeq(0); // odd while the render thread is writing telemetrySample.
+int telemetryInterval; // samples between telemetry messages.
+int telemetryOnsets = 0;
+float telemetryAccuracySum = 0;
+//----------------------------------
+
+// Snapshot variables (see Snapshot.h)
+// What the tracker has learned, saved every SNAPSHOT_MS so a restart after a crash or a power cut doesn't go
+// back to 120 bpm and the default thresholds. The render thread copies it into snapshotState (odd snapshotSeq
+// while writing, as for the telemetry) and the aux task stamps it with the wall clock and writes it to the file.
+// setup() restores it, and if the clock was running less than SNAPSHOT_RESUME_S ago the slaves are sent a
+// Start straight away at the saved tempo. The age needs the wall clock to survive the restart (NTP from the
+// laptop or an RTC), a clock that has gone backwards counts as too old.
+struct TrackerState
+{
+	double savedAt; // wall clock (s).
+	int running; // the slaves had been sent a Start.
+	float bpm;
+	float tempoThreshold;
+	float syncThreshold;
+	float tempoStdDev;
+	float syncStdDev;
+	TrackerParams params; // the weights and meter in use.
+};
+const char* snapshotPath = "tracker.snapshot"; // in the project folder, 0 = none (the Tools/Host replays).
+int snapshotResume = -1; // -1 = by the snapshot's age, 0 or 1 to decide (Tools/Journal replaying a session that was restored).
+SnapshotFile snapshotFile = {};
+AuxiliaryTask snapshotTask;
+TrackerState snapshotState;
+std::atomic<unsigned int> snapshotSeq(0);
+//----------------------------------
+
+// Journal variables (see Journal.h)
+// Everything the tracker heard and did goes in the journal: the footswitch, the parameter sets, each onset's
+// crossing with the classifier window's samples and its release, each tracker decision and reset, and every Midi
+// byte. That's enough for Tools/Journal to feed the onsets back in and get the same decisions. journalTimer has
+// the aux task write it out every JOURNAL_MS. About 2 MB an hour with the clock running.
+const char* journalPath = "journal-%Y%m%d-%H%M%S.pj"; // strftime() pattern, in the project folder, 0 = none.
+JournalRing journal;
+FILE* journalFile = 0;
+AuxiliaryTask journalTask;
+float onsetRecord[JOURNAL_MAX_WINDOW + 1]; // the JOURNAL_ONSET payload: the label in the first 4 bytes, then the window.
+int onsetWindowCount = 0;
+//----------------------------------
+
+// OSC control variables
+OSCServer oscServer;
+AuxiliaryTask getOsc;
+//----------------------------------
+
+// Stage profiling variables (see StageProfiler.h)
+// "/pulse/profile/dump" prints the histograms from the OSC aux task, "/pulse/profile/reset" clears them.
+StageHistogram onsetProfile = {"onsets"}; // analog loop, not counting tempoAdjust() and syncAdjust().
+StageHistogram tempoProfile = {"tempoAdjust"};
+StageHistogram syncProfile = {"syncAdjust"};
+StageHistogram classifyProfile = {"classifier"}; // per onset: every feedOnset() in the window plus classifyOnset().
+StageHistogram audioProfile = {"audioInput"}; // per block, only in ONSET_SOURCE_AUDIO.
+StageHistogram timerProfile = {"timers"}; // clock pulses, LED edges, reset and telemetry.
+StageHistogram renderProfile = {"render"};
+std::atomic<bool> profileResetRequest(false); // Set by the aux task, the render thread does the reset.
+uint32_t profileNested = 0;
+uint32_t classifyCycles = 0; // Adds up the current onset's classifier cost across blocks.
+bool flushToZeroSet = false;
+//----------------------------------
+
+// Latency measurement variables
+// In latency mode each onset that changes the clock (pulseTarget, or the phase through phasePending) is tagged
+// with its sample time and the time of the first clock pulse sent after it is recorded, giving the onset to
+// clock correction latency.
+// "/pulse/latency/start" clears and starts a session, "/pulse/latency/stop" ends it and prints the report.
+// Midi bytes go out as render() writes them, so a pulse later in the same block counts from the onset's frame.
+bool latencyMode = false;
+bool latencyPending = false; // An onset has corrected the clock and is waiting for its first pulse.
+uint64_t latencyOnsetSample = 0;
+unsigned int latencyHistogram[LATENCY_BUCKETS];
+unsigned int latencyCount = 0;
+unsigned int latencyUncorrected = 0; // Onsets that didn't change the clock.
+float latencyMax = 0;
+double latencySum = 0;
+std::atomic<int> latencyRequest(0); // 1 = start, 2 = stop (set by the aux task, handled by the render thread).
+std::atomic<bool> latencyReporting(false); // latencyReportTask is reading the histogram, so a new session waits.
+AuxiliaryTask latencyReportTask;
+void latencyReport();
+void printLatencyReport();
+//----------------------------------
+
 // &&&&&&&&&&&& SETUP %%%%%%%%%%%%%%%%%%%%%
 bool setup(BelaContext *context, void *userData)
 {
@@ -135,19 +465,37 @@ bool setup(BelaContext *context, void *userData)
 	midi.writeTo(gMidiPort0);
 	midi.enableParser(true);
 	oneMs = context->audioSampleRate / 1000.0;
-	digitalSampleRate = context->digitalSampleRate;
+	analogSampleRate = context->analogSampleRate;
+	audioSampleRate = context->audioSampleRate;
+	audioFramesPerFrame = context->analogFrames ? context->audioFrames / context->analogFrames : 1;
+	retriggerFrames = (RETRIGGER_MS * context->analogSampleRate) / 1000;
+	audioInputs = context->audioInChannels;
+	debounceSamples = (DEBOUNCE_MS * context->digitalSampleRate) / 1000;
 	calculateStandardNoteDivisions(bpm);
-
-	for(int t = 0; t < 4; t ++) // Resetting the timer array to null.
-	{
-		timerArray[t] = 0.0;
-	}
 	
 	if(context->analogFrames == 0) 
 	{
 		rt_printf("Error: this example needs the analog I/O to be enabled\n");
 		return false;
 	}
+	
+	if(context->analogFrames > MAX_ANALOG_FRAMES)
+	{
+		rt_printf("Error: blocks of up to %d analog frames please\n", MAX_ANALOG_FRAMES);
+		return false;
+	}
+	
+	if(context->analogFrames > context->audioFrames || context->audioFrames % context->analogFrames) // Each analog frame is a whole number of audio frames.
+	{
+		rt_printf("Error: the analog inputs can't run faster than the audio, use 4 or 8 analog channels\n");
+		return false;
+	}
+	
+	if(context->analogInChannels <= PIEZO_CHANNEL)
+	{
+		rt_printf("Error: the piezo is on analog input %d, that needs more than %d analog channels\n", PIEZO_CHANNEL, context->analogInChannels);
+		return false;
+	}
 
 	if(context->audioOutChannels < 2 ||
 		context->analogOutChannels < 2)
@@ -156,16 +504,73 @@ bool setup(BelaContext *context, void *userData)
 		return false;
 	}
 
+	if(journalPath) // Only once the context has passed, so a refused start leaves no journal behind.
+	{
+		char name[256];
+		time_t wallClock = time(0);
+		strftime(name, sizeof(name), journalPath, localtime(&wallClock));
+		journalFile = fopen(name, "wb");
+		if(journalFile)
+		{
+			uint32_t header[5] = {JOURNAL_MAGIC, JOURNAL_VERSION, 0, context->audioFrames, context->analogFrames};
+			memcpy(&header[2], &context->audioSampleRate, 4);
+			journalEvent(0, JOURNAL_HEADER, header, sizeof(header));
+		}
+		else
+		{
+			rt_printf("Can't write the journal %s\n", name);
+		}
+	}
+	
+	for(int p = 0; p < 3; p ++)
+	{
+		paramSlots[p] = defaultParams;
+	}
+	stagedParams = defaultParams;
+	applyParams();
+	restoreSnapshot();
+	journalEvent(0, JOURNAL_PARAMS, params, sizeof(TrackerParams));
+
+	resetTapTempo(tapTempo);
+	
 	gSamplingPeriod = 1.0 /context->audioSampleRate;
-	sampleInterval = ((60000 / bpm) / 24) * 44.1; // equation to determine the miliseconds needed per pulse.
-										// ...Because Midi clock needs 24 pulses per quaternote (PPQ)
-										// then I multiply by 44.1 to give the result in samples.
+	setPulseInterval();
+	pulseSpacing = pulseTarget; // No glide at startup.
+	glideRemaining = 0;
+	initTimerWheel(timerWheel, context->audioFrames);
+	pulseOrigin = 0;
+	pulseCountdown = pulseSpacing;
+	schedulePulse();
+	resetSamples = RESET_MS * oneMs;
+	scheduleTimer(timerWheel, resetTimer, resetSamples); // Counting from the start as if there had been an onset.
 	// midi_byte_t startByte = 250;
 	// midi.writeOutput(startByte);
 	pinMode(context, 0, P8_07, OUTPUT); // LED for TAP_MODE
 	pinMode(context, 0, P8_08, INPUT); // footswitch
 	pinMode(context, 0, P8_09, OUTPUT); // LED for TRACK_MODE
 
+	telemetryClient.setup(7563, "192.168.7.1"); // Sending tracker state to the host laptop.
+	telemetryTask = Bela_createAuxiliaryTask(telemetryCallback, 50, "telemetry"); // Low priority, below the audio and midi threads.
+	telemetryInterval = context->audioSampleRate / TELEMETRY_RATE;
+	scheduleTimer(timerWheel, telemetryTimer, telemetryInterval);
+	confidenceGap = ceilf(4 * MIDI_BYTE_MS * oneMs);
+	songPositionGap = ceilf(6 * MIDI_BYTE_MS * oneMs);
+	scheduleTimer(timerWheel, confidenceTimer, context->audioSampleRate / CONFIDENCE_RATE);
+	latencyReportTask = Bela_createAuxiliaryTask(latencyReport, 50, "latencyReport");
+	if(snapshotFile.slots)
+	{
+		snapshotTask = Bela_createAuxiliaryTask(snapshotCallback, 40, "snapshot"); // Below the telemetry, it waits on the SD card.
+		scheduleTimer(timerWheel, snapshotTimer, SNAPSHOT_MS * oneMs);
+	}
+	if(journalFile)
+	{
+		journalTask = Bela_createAuxiliaryTask(journalCallback, 40, "journal");
+		scheduleTimer(timerWheel, journalTimer, JOURNAL_MS * oneMs);
+	}
+	
+	oscServer.setup(7562); // Receiving parameter changes from the host laptop.
+	getOsc = Bela_createAuxiliaryTask(oscCallback, 50, "getOsc"); // Creating aux task to read the Osc Messages.
+
 	return true;
 }
 
@@ -173,115 +578,175 @@ bool setup(BelaContext *context, void *userData)
 //&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&
 void render(BelaContext *context, void *userData)
 {
-	for(unsigned int n = 0; n < context->analogFrames; n++)
+	if(!flushToZeroSet) // Has to be done from the render thread (see FlushToZero.h).
 	{
-		float piezo = analogRead(context, n, 6); // reading the piezo value to detect Kick onsets..
-		samplesSinceLastTap++;
-		msSinceLastTap = (samplesSinceLastTap / context->audioSampleRate) * 1000.0;
-		seconds = context->audioFramesElapsed / context->audioSampleRate;
-		pulseMode = digitalRead(context, 0, P8_08); // Reading the state of the footswitch.
-		
-		if(pulseMode == TAP_MODE)
+		enableFlushToZero();
+		flushToZeroSet = true;
+	}
+	advanceTimerWheel(timerWheel, context->audioFramesElapsed);
+	PROFILE_START(renderStart);
+	if(profileResetRequest.exchange(false))
+	{
+		resetStageHistogram(onsetProfile);
+		resetStageHistogram(tempoProfile);
+		resetStageHistogram(syncProfile);
+		resetStageHistogram(classifyProfile);
+		resetStageHistogram(audioProfile);
+		resetStageHistogram(timerProfile);
+		resetStageHistogram(renderProfile);
+		memset(onsetCounts, 0, sizeof(onsetCounts));
+	}
+	
+	takeNewParams(); // Picking up a new parameter set if one has been sent over OSC.
+	
+	int latencyChange = latencyReporting.load(std::memory_order_acquire) ? 0 : latencyRequest.exchange(0); // Left for a later block while a report is being printed.
+	if(latencyChange == 1) // Start a new measurement session.
+	{
+		for(int b = 0; b < LATENCY_BUCKETS; b++)
 		{
-			if(coarseOn == false)
+			latencyHistogram[b] = 0;
+		}
+		latencyCount = 0;
+		latencyUncorrected = 0;
+		latencyMax = 0;
+		latencySum = 0;
+		latencyPending = false;
+		latencyMode = true;
+	}
+	else if(latencyChange == 2 && latencyMode) // End the session and print the report.
+	{
+		latencyMode = false;
+		latencyPending = false; // An onset waiting for its pulse now would land after the stop.
+		latencyReporting.store(true, std::memory_order_release);
+		Bela_scheduleAuxiliaryTask(latencyReportTask);
+	}
+	
+	if(oscServer.messageWaiting())
+	{
+		Bela_scheduleAuxiliaryTask(getOsc);
+	}
+	
+	updateMode(context); // Reading the state of the footswitch, once per block.
+	
+	if(params->onsetSource == ONSET_SOURCE_AUDIO) // The levels the onset loop reads instead of the piezo.
+	{
+		PROFILE_START(audioStart);
+		for(unsigned int n = 0; n < context->analogFrames; n++)
+		{
+			for(unsigned int a = n * audioFramesPerFrame; a < (n + 1) * audioFramesPerFrame; a++)
 			{
-				coarseOn = true;
-				coarseTaps = 0;
-				trackOn = false;
-				digitalWrite(context, n, P8_09, 0);
-				tapCount = 0;
-				enoughCoarseTaps = false;
+				feedAudioOnset(audioDetector, audioDetectorParams, audioRead(context, a, params->audioChannel));
 			}
+			audioLevels[n] = audioOnsetLevel(audioDetector, audioDetectorParams);
 		}
+		PROFILE_END(audioProfile, audioStart);
+	}
+	
+	PROFILE_START(onsetStart);
+	profileNested = 0;
+	uint64_t firstAnalogFrame = context->audioFramesElapsed / audioFramesPerFrame;
+	for(unsigned int n = 0; n < context->analogFrames; n++)
+	{
+		float piezo; // reading the piezo value to detect Kick onsets..
+		if(params->onsetSource == ONSET_SOURCE_AUDIO)
+			piezo = audioLevels[n]; // ..or the audio input's level, which looks like it.
+		else
+			piezo = analogRead(context, n, PIEZO_CHANNEL);
 		
-		else if(pulseMode == TRACK_MODE)
+		bool windowFull = false;
+		if(piezo > params->onsetThreshold && trig == false) // ONSET DETECTED, if not already triggered.
 		{
-			if(trackOn == false)
-			{
-				trackOn = true;
-				coarseOn = false;
-				digitalWrite(context, n, P8_07, 0);
-			}
+			trig = true;
+			retriggerFrame = firstAnalogFrame + n + retriggerFrames;
+			onsetSample = context->audioFramesElapsed + n * audioFramesPerFrame;
+			onsetTime = (onsetSample / context->audioSampleRate) * 1000; // the time of the crossing in ms, to the frame.
+			classifyCycles = 0;
+			onsetRecord[1] = piezo;
+			onsetWindowCount = 1;
+			PROFILE_START(classifyStart);
+			windowFull = startOnset(classifier, classifierParams, piezo);
+			PROFILE_ACCUMULATE(classifyStart, classifyCycles);
 		}
-
-		if(trig == true)
+		else if(classifier.active) // Still collecting the onset's window.
 		{
-			timeOutCount++;
+			if(onsetWindowCount < JOURNAL_MAX_WINDOW)
+			{
+				onsetRecord[1 + onsetWindowCount++] = piezo;
+			}
+			PROFILE_START(classifyStart);
+			windowFull = feedOnset(classifier, classifierParams, piezo);
+			PROFILE_ACCUMULATE(classifyStart, classifyCycles);
 		}
 		
-		if(msSinceLastTap >= 4000.0 && resetFlag == false) // Been a long time since recent onset so will start the process of collecting onsets and comparing again.
-		{
-			resetFlag = true;
-			tapCount = 0;
-			timerIndex = 0;
-			beatPos = -1;
-			enoughTrackTaps = false;
-			enoughCoarseTaps = false;
-			enoughTaps = false;
-			status = GPIO_HIGH;
-			if(pulseMode == TAP_MODE)
+		if(windowFull) // Time to label the onset.
+		{
+			PROFILE_START(classifyStart);
+			OnsetClass label = classifyOnset(classifier, classifierParams, (onsetTime - lastKickTime) * analogSampleRate / 1000);
+			PROFILE_ACCUMULATE(classifyStart, classifyCycles);
+			PROFILE_RECORD(classifyProfile, classifyCycles);
+			onsetCounts[label] ++;
+			if(label == ONSET_KICK)
 			{
-			digitalWrite(context, n, P8_07, status); //Switching LED back on to indicate no Tempo Tracking.
+				lastKickTime = onsetTime;
 			}
-			else if (pulseMode == TRACK_MODE)
+			if(journalFile)
 			{
-			digitalWrite(context, n, P8_09, status);	
+				uint32_t labelBytes = label;
+				memcpy(onsetRecord, &labelBytes, 4);
+				journalEvent(onsetSample, JOURNAL_ONSET, onsetRecord, (1 + onsetWindowCount) * 4);
 			}
 			
-			rt_printf("TOO LONG SINCE LAST TAP, RESET\n");
-
-			for(int t = 0; t < 4; t ++) // Resetting the timer array to null.
+			if(label == ONSET_BLEED) // Not one for the tracker, and it doesn't need the retrigger timeout either.
 			{
-				timerArray[t] = 0.0;
+				retriggerFrame = 0;
+				rt_printf("ONSET REJECTED (%s, peak %f, rise %d, decay %f)\n", onsetClassNames[label],
+					classifier.features.peak, classifier.features.rise, classifier.features.decay);
 			}
-		}
-		
-		if(piezo > 0.3) // ONSET DETECTED.
-		{
-			if(trig == false) // if not already triggered.
+			else // KICK or GHOST, on to the tracker.
 			{
-				msSinceLastTap = 0;
-				samplesSinceLastTap = 0;
-				trig = true;
-				resetFlag = false;
-				now = (context->audioFramesElapsed / context->audioSampleRate) * 1000; // getting the time NOW (* 1000 for ms?).
+				unsigned int frame = n * audioFramesPerFrame;
+				if(resetTimer.armed && resetTimer.due <= context->audioFramesElapsed + frame) // Due before this onset, so it goes first.
+				{
+					cancelTimer(timerWheel, resetTimer);
+					resetTracking(context, resetTimer.due - context->audioFramesElapsed);
+				}
+				scheduleTimer(timerWheel, resetTimer, context->audioFramesElapsed + frame + resetSamples);
+				now = onsetTime;
 				timer = now - lastTap; // working out difference between now and the last tap.
 				lastTap = now; // updating the last tap to THIS tap.
 				onsets[onsetInd] = now; // placing onset CPU time in ring buffer.
 				onsetInd = (onsetInd + 1) % MAX_ONSETS; // incrementing and wrapping around.
+				float oldPulseTarget = pulseTarget;
+				float oldPhasePending = phasePending;
 
 				tapCount ++;
 				
-				float summedIOI = 0.0;
-				int elapsedTaps = tapCount;
-					if(tapCount > MAX_COARSE_ONSETS)
+				if(tapCount > 1) // The first since a reset is timed from a tap before it.
 				{
-					elapsedTaps = MAX_COARSE_ONSETS;
+					addTap(tapTempo, timer);
 				}
-
-				timerArray[timerIndex] = timer;
-				timerIndex = (timerIndex + 1) % MAX_COARSE_ONSETS;
+				averageIOI = tapEstimate(tapTempo); // Calculating the Coarse BPM assesmnt at this stage.
 				
-				for(int i = 0; i < MAX_COARSE_ONSETS; i ++) // Obtaining average IOI time between quarter pulses.
-				{
-					summedIOI += timerArray[i];
-				}
-				
-				averageIOI = summedIOI / elapsedTaps; // Calculating the Coarse BPM assesmnt at this stage.
-				
-				if(tapCount >= 5) // If we have enough relevent recent onsets to compare to then we will execute the algorithm.
+				if(tapCount >= (pulseMode == TAP_MODE ? TAP_MIN_TAPS : 5)) // If we have enough relevent recent onsets to compare to then we will execute the algorithm.
 				{
 					// execute the main algorithms.
 					if(pulseMode == TRACK_MODE)
 					{
+						PROFILE_START(syncStart);
 						syncAdjust();
+						PROFILE_NESTED_END(syncProfile, syncStart, profileNested);
+						PROFILE_START(tempoStart);
 						tempoAdjust(); 
+						PROFILE_NESTED_END(tempoProfile, tempoStart, profileNested);
 						enoughTrackTaps = true;
+						updateConfidence();
+						telemetryOnsets ++;
+						telemetryAccuracySum += onsetAccuracy;
 					}
-					else if (pulseMode == TAP_MODE)
+					else if (pulseMode == TAP_MODE && averageIOI > 0)
 					{
 						bpm = 60000 / averageIOI;
-						sampleInterval = ((60000 / bpm) / 24) * 44.1;
+						setPulseInterval();
 						calculateStandardNoteDivisions(bpm);
 						rt_printf("TAP ADJUSTMENT, 	BPM estimate = %f\n", bpm);
 						enoughCoarseTaps = true;
@@ -291,135 +756,104 @@ void render(BelaContext *context, void *userData)
 						{
 							enoughTaps = true;
 							midi_byte_t startByte = 250;
-							midi.writeOutput(startByte);
+							writeMidi(context->audioFramesElapsed + frame, &startByte, 1);
 							rt_printf("MIDI START MESSAGE\n");
+							// Slaves count the bar from the first pulse after Start, so the grid starts again with a pulse on this onset.
+							frames = 0;
+							barCount = 0;
+							resetDownbeat();
+							songPositionPending = false;
+							locksSinceStart = 0;
+							barMoved = 0;
+							pulseOrigin = context->audioFramesElapsed;
+							pulseCountdown = frame + 1;
+							phasePending = 0;
+							schedulePulse();
+							mostRecentMidiClickTime = ((context->audioFramesElapsed + pulseCountdown) / context->audioSampleRate) * 1000;
 						}
 				}
 				else if (tapCount < 5)
 				{
-					if(pulseMode == TRACK_MODE)
+					if(pulseMode == TRACK_MODE && timer > 0) // timer is 0 if the first onset comes in the very first block.
 					{
 						bpm = 60000 / timer; // or / timer?
-						sampleInterval = ((60000 / bpm) / 24) * 44.1;
+						setPulseInterval();
 						calculateStandardNoteDivisions(bpm);
 						rt_printf("Coarse ADJUSTMENT, 	BPM estimate = %f\n", bpm);
 					}
 				}
 				
-				
-				
-			} // End of piezo trigger brace.
-		} // End of piezo threshold brace.
-		
-		if (piezo < 0.05) // Setting up for retriggering if fallen below the low threshold.
-		{
-			if (trig == true && timeOutCount > 5000 ) // if it has been triggered and Timeout is completed then untrigger it.
-			{
-				trig = false;
-				timeOutCount = 0;
-			}
-		}
-	}
-	
-	for(unsigned int n=0; n<context->digitalFrames; n++) // LED handling section.
-	{
-		if(pulseMode == TRACK_MODE)
-		{
-			if(enoughTrackTaps) // If enough taps then we have a BPM estimate and can start tempo tracking.
-			{
-
-					if (onFlag) // This is triggered every quarter note (in the audio frames loop)
+				if(latencyMode)
+				{
+					if(pulseTarget != oldPulseTarget || phasePending != oldPhasePending) // Even by less than a sample.
 					{
-						if(status == GPIO_LOW)
-						{
-						    status=GPIO_HIGH; // Switch Light on to coincide with quarternote pulse.
-							digitalWrite(context, n, P8_09, status); //write the status to the LED
-						}
-						
-						timeOutCount++;
-    					if(timeOutCount == timeOutsamples)
-    					{
-    						status=GPIO_LOW; // Switch LED off after timeout phase.	
-    						digitalWrite(context, n, P8_09, status); //write the status to the LED
-							timeOutCount = 0;
-							onFlag = false;
-    					}
+						// A later correction replaces one that hasn't reached a pulse yet.
+						latencyOnsetSample = onsetSample; // The crossing, so the classifier window counts towards the latency.
+						latencyPending = true;
 					}
-	
-			}
-		
-			else // If not enough taps then LED is steadily on just to show signs of life.
-			{
-				 status = GPIO_HIGH; // Switch Light on to coincide with quarternote pulse.
-				 digitalWrite(context, n, P8_09, status); //write the status to the LED
-			}
-		}
-		
-		else if (pulseMode == TAP_MODE)
-		{
-			if(enoughCoarseTaps) // If enough taps then we have a BPM estimate and can start tempo tracking.
-			{
-
-					if (onFlag) // This is triggered every quarter note (in the audio frames loop)
+					else
 					{
-						if(status == GPIO_LOW)
-						{
-						    status=GPIO_HIGH; // Switch Light on to coincide with quarternote pulse.
-							digitalWrite(context, n, P8_07, status); //write the status to the LED
-						}
-						
-						timeOutCount++;
-    					if(timeOutCount == timeOutsamples)
-    					{
-    						status=GPIO_LOW; // Switch LED off after timeout phase.	
-    						digitalWrite(context, n, P8_07, status); //write the status to the LED
-							timeOutCount = 0;
-							onFlag = false;
-    					}
+						latencyUncorrected ++;
 					}
-	
-			}
-			
-			else // If not enough taps then LED is steadily on just to show signs of life.
+				}
+				
+				if(journalFile)
+				{
+					JournalTempo decision = {(uint8_t)pulseMode, bpm, tempoThreshold, onsetAccuracy, syncDelta, beatPos};
+					journalEvent(context->audioFramesElapsed + frame, JOURNAL_TEMPO, &decision, sizeof(decision));
+				}
+			} // End of tracker brace.
+		} // End of onset brace.
+		
+		if (piezo < params->releaseThreshold) // Setting up for retriggering if fallen below the low threshold.
+		{
+			if (trig == true && firstAnalogFrame + n > retriggerFrame) // if it has been triggered and Timeout is completed then untrigger it.
 			{
-				 status = GPIO_HIGH; // Switch Light on to coincide with quarternote pulse.
-				 digitalWrite(context, n, P8_07, status); //write the status to the LED
+				trig = false;
+				journalEvent(context->audioFramesElapsed + n * audioFramesPerFrame, JOURNAL_RELEASE);
 			}
 		}
 	}
+	PROFILE_END_EXCLUDING(onsetProfile, onsetStart, profileNested);
 	
-	for(unsigned int n = 0; n < context->audioFrames; n++)
+	PROFILE_START(timerStart);
+	updateLeds(context);
+	unsigned int frame;
+	while(Timer* t = nextTimer(timerWheel, frame)) // Clock pulses, LED edges, reset and telemetry due in this block, in time order.
 	{
-		count ++; // count up each sample.
-
-		if(!(count % (int)(oneMs * eightNote))) // Every EighthNote.
-		{
-			mostRecentMidiClickTime = (context->audioFramesElapsed / context->audioSampleRate) * 1000; // Getting the time NOW.
-
-			if(enoughTrackTaps)
-			{
-				beatPos ++;
-				if(beatPos > 7)
-				{
-					beatPos = 0;
-				}
-
-			}
-			
-		}
-		
-		if(!(count % sampleInterval)) // when the samplecount reaches the calculated number to represent a 24th of a quater pulse.
+		switch(t->id)
 		{
-			midi_byte_t clockPulse = 248; // Midi byte is set to decimal 248 (Midid devices recognise this as clock pulse)
-			midi.writeOutput(clockPulse); // Send the pulse to the device.
-			frames ++; // increment the number of frames
-			if (frames == 24) // when we've reached a whole quaternote
-			{
-				frames = 0;
-				onFlag = true;
-			}
+			case TIMER_PULSE:
+				clockPulse(context, frame);
+				break;
+			case TIMER_LED_OFF:
+				setLed(context, (frame * context->digitalFrames) / context->audioFrames, pulseMode, GPIO_LOW);
+				break;
+			case TIMER_RESET:
+				resetTracking(context, frame);
+				break;
+			case TIMER_TELEMETRY: // Once per telemetry period, not per onset.
+				publishTelemetry(context);
+				Bela_scheduleAuxiliaryTask(telemetryTask);
+				scheduleTimer(timerWheel, telemetryTimer, t->due + telemetryInterval);
+				break;
+			case TIMER_SNAPSHOT:
+				publishSnapshot();
+				Bela_scheduleAuxiliaryTask(snapshotTask);
+				scheduleTimer(timerWheel, snapshotTimer, t->due + (uint64_t)(SNAPSHOT_MS * oneMs));
+				break;
+			case TIMER_JOURNAL:
+				Bela_scheduleAuxiliaryTask(journalTask);
+				scheduleTimer(timerWheel, journalTimer, t->due + (uint64_t)(JOURNAL_MS * oneMs));
+				break;
+			case TIMER_CONFIDENCE:
+				sampleConfidence();
+				scheduleTimer(timerWheel, confidenceTimer, t->due + (uint64_t)(context->audioSampleRate / CONFIDENCE_RATE));
+				break;
 		}
 	}
+	PROFILE_END(timerProfile, timerStart);
+	PROFILE_END(renderProfile, renderStart);
 }
 // cleanup() is called once at the end, after the audio has stopped.
 // Release any resources that were allocated in setup().
@@ -427,7 +861,26 @@ void render(BelaContext *context, void *userData)
 void cleanup(BelaContext *context, void *userData)
 {
 	midi_byte_t stopByte = 252;
-	midi.writeOutput(stopByte);
+	writeMidi(context->audioFramesElapsed, &stopByte, 1);
+	
+	if(latencyMode) // Session still running when we stopped, so report it now.
+	{
+		latencyReport();
+	}
+	
+	if(snapshotFile.slots) // The audio has stopped, so the last state can be saved from here.
+	{
+		publishSnapshot();
+		snapshotCallback();
+		closeSnapshot(snapshotFile);
+	}
+	
+	if(journalFile)
+	{
+		drainJournal(journal, journalFile);
+		fclose(journalFile);
+		journalFile = 0;
+	}
 }
 
 // The main tempo tracking algorithm, called from the main thread when an onset is detected (with enough recent onsets to be relevent).
@@ -463,12 +916,13 @@ void tempoAdjust()
 		//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 		// Classifying the IOI as a regular period Duration (in eighth notes) @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 		
-		periodDurations[k] = round(IOIs[k] / eightNote); // the round function gives us the closest regular duration that the IOI represents (in eigthnotes).
+		float periods = roundf(IOIs[k] / eightNote); // the round function gives us the closest regular duration that the IOI represents (in eigthnotes).
+		periodDurations[k] = fminf(fmaxf(periods, -1), 16); // Anything outside 1 to 15 eighth notes gets no accuracy, so clamped there it can index nothing (or overflow the int).
 		//@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 		
 		// Determining the Performance Error between the actual IOI and the regular duration it is closest to.
 		// &&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&
-		PEs[k] = IOIs[k] - (periodDurations[k] * eightNote);
+		PEs[k] = IOIs[k] - (periods * eightNote);
 		summedPEs += PEs[k];
 		//&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&&
 		// Calculating overall accuracy  **********************************************************
@@ -477,14 +931,14 @@ void tempoAdjust()
 		   Into a Gaussian window and then scaling this result with a weight dependent on the determined periodDuration */
 		if(periodDurations[k] < 16 && periodDurations[k] > 0)
 		{
-		accuracies[k] = gaussianTempo(PEs[k]) * tempoWeights[periodDurations[k] - 1];  // -1 because the first index of tempoWeights[] should represent 1 eighth note and not 0 eighth notes.
+		accuracies[k] = gaussianTempo(PEs[k]) * params->tempoWeights[periodDurations[k] - 1];  // -1 because the first index of tempoWeights[] should represent 1 eighth note and not 0 eighth notes.
 		}
 		else
 		{
 			accuracies[k] = 0.f;
 		}
 		// *****************************************************************************************
-		rt_printf("periodDuration[%d] = %d 		PE[%d] = %f \n Accuracy[%d] = %f 	Gaussian result = %f	Tempoweight[%d] = %.2f\n", k, periodDurations[k], k, PEs[k], k, accuracies[k], gaussianTempo(PEs[k]), periodDurations[k] -1, tempoWeights[periodDurations[k] - 1]);
+		rt_printf("periodDuration[%d] = %d 		PE[%d] = %f \n Accuracy[%d] = %f 	Gaussian result = %f	Tempoweight[%d] = %.2f\n", k, periodDurations[k], k, PEs[k], k, accuracies[k], gaussianTempo(PEs[k]), periodDurations[k] -1, accuracies[k] > 0 ? params->tempoWeights[periodDurations[k] - 1] : 0.f);
 	} // End of processing For Loop
 	
 	PEsMean = fabs(summedPEs / (MAX_ONSETS - 1));
@@ -507,7 +961,7 @@ void tempoAdjust()
 	if (mostAccurate > tempoThreshold)
 	{
 		// This is how much the tempo needs to change and is determined by using the winning IOI data.
-		tempoDelta = alpha * gaussianTempo(PEs[win]) * tempoWeights[periodDurations[win] - 1] * (PEs[win] / (periodDurations[win]));
+		tempoDelta = params->alpha * gaussianTempo(PEs[win]) * params->tempoWeights[periodDurations[win] - 1] * (PEs[win] / (periodDurations[win]));
 		
 			if (mostAccurate >= tempoThreshold + 0.1) // If most accurate is over the threshold AND the headroom then update the threshold.
 		{
@@ -533,88 +987,209 @@ void tempoAdjust()
 
 	oldBpm = bpm;
 	bpm = bpm + ((tempoDelta * -1.0) + syncDelta); // This is where the Bpm/tempo is updated. If in sync then the syncDelta variable will be 0.
+	if(!std::isfinite(bpm))
+	{
+		bpm = oldBpm;
+	}
 	
-	if(bpm < 60.f) // constraining the bpm extremes.
+	if(bpm < params->minBpm) // constraining the bpm extremes.
 	{
-		bpm = 60.f;
+		bpm = params->minBpm;
 	}
 	
-	if(bpm > 240.f)
+	if(bpm > params->maxBpm)
 	{
-		bpm = 240.f;
+		bpm = params->maxBpm;
 	}
 	calculateStandardNoteDivisions(bpm);
-	sampleInterval = ((60000 / bpm) / 24) * 44.1; // Calculating how many samples for the Midi Pulse (24 pulses per quarterNote).
+	setPulseInterval(); // Calculating how many samples for the Midi Pulse (24 pulses per quarterNote).
+	onsetAccuracy = mostAccurate;
 	rt_printf("TRACK ADJUSTMENT Bpm = %f 	newBpm = %f\n", oldBpm, bpm);
 	rt_printf("Tempo Threshold = %f 	TempoStdDev = %f 	TempoDelta = %f\n", tempoThreshold, tempoStdDev,tempoDelta);
 
 	// // And the final parameter to update is the tempoStdDev which pivots around an equilibrium point of 0.7..
-	tempoStdDev = fabs(PEsCumDifs / PEsMean);
-	tempoStdDev = tempoStdDev * (1 + ((0.7 * tempoWeights[periodDurations[win]]) - mostAccurate));
-	if(tempoStdDev > 2000.0)
+	float newStdDev = fabs(PEsCumDifs / fmaxf(PEsMean, PE_MEAN_MIN));
+	float winWeight = periodDurations[win] >= 0 && periodDurations[win] < 16 ? params->tempoWeights[periodDurations[win]] : 0.f;
+	newStdDev = newStdDev * (1 + ((0.7 * winWeight) - mostAccurate));
+	if(std::isfinite(newStdDev))
 	{
-		tempoStdDev = 2000.0;
+		tempoStdDev = fminf(fmaxf(newStdDev, TEMPO_STD_DEV_MIN), TEMPO_STD_DEV_MAX);
 	}
 } // End of Tempo Process.
 
 void syncAdjust()
 {
-	float discrepency;
-	float proximityToExpected;
-	float discrepencySum = 0;
-	float discrepencyMean = 0;
-	float discrepencyCumDifs = 0;
+	// Phase error against the nearest eighth note of the clock grid, and that eighth note's position in the bar.
+	float sinceClick = now - (mostRecentMidiClickTime + phasePending / oneMs);
+	if(!std::isfinite(sinceClick))
+	{
+		syncDelta = 0;
+		return;
+	}
+	int position = beatPos < 0 ? 0 : beatPos;
+	phaseError = sinceClick;
+	if(sinceClick > eightNote / 2) // Closer to the next eighth note.
+	{
+		phaseError = sinceClick - eightNote;
+		position = (position + 1) % params->barLength;
+	}
 	
-	int newBeatPos = (beatPos + beatOffset) % sizeof(syncWeights);
+	float window = syncLocked ? PLL_CAPTURE * eightNote : eightNote / 2;
+	if(fabsf(phaseError) > window) // Outside the capture window, so this onset doesn't steer the clock.
+	{
+		syncDelta = 0;
+		if(syncLocked && ++missCount >= PLL_MAX_MISSES)
+		{
+			resetSync();
+			rt_printf("SYNC LOST (missed onsets)\n");
+		}
+		return;
+	}
+	missCount = 0;
+	position = (position + params->barLength - updateDownbeat(position)) % params->barLength; // Follow the bar if it moved.
 	
-	discrepency = now - closestMidiClickTime;
+	// Loop filter. Weaker positions in the bar steer the clock less.
+	float weight = params->syncWeights[position] * params->beta;
+	float kp = (syncLocked ? PLL_TRACK_KP : PLL_ACQUIRE_KP) * weight;
+	float ki = (syncLocked ? PLL_TRACK_KI : PLL_ACQUIRE_KI) * weight;
 	
-	discrepencies[onsetInd] = discrepency;
+	float phaseShift = kp * phaseError; // ms
+	phasePending += phaseShift * oneMs; // Later onset, later clock, spread over the next pulses by clockPulse().
 	
-	if (fabs(discrepency) < 100) // If within 100 ms of an expected Beat.
+	syncDelta = -bpm * (ki * phaseError) / eightNote; // Later onsets mean the clock period is too short, so slow down.
+	if(syncDelta > PLL_MAX_DELTA)
 	{
-		proximityToExpected = gaussianSync(discrepency) * syncWeights[newBeatPos];
-		
-		// If the onset is close to the expected beat (but not so close!) then we syncronise.
-		if (proximityToExpected > syncThreshold && proximityToExpected < (syncThreshold + 0.1)) 
+		syncDelta = PLL_MAX_DELTA;
+	}
+	else if(syncDelta < -PLL_MAX_DELTA)
+	{
+		syncDelta = -PLL_MAX_DELTA;
+	}
+	
+	// Lock detection.
+	filteredPhaseError += 0.25 * (fabsf(phaseError) - filteredPhaseError);
+	syncStdDev = sqrtf(syncStdDev * syncStdDev + 0.25 * (phaseError * phaseError - syncStdDev * syncStdDev));
+	
+	if(!syncLocked)
+	{
+		lockCount = filteredPhaseError < syncThreshold ? lockCount + 1 : 0;
+		if(lockCount >= PLL_LOCK_ONSETS)
 		{
-			syncDelta = (((gaussianSync(discrepency) + beta) / (beta + 1)) * gaussianSync(discrepency) * syncWeights[newBeatPos] * discrepency);
+			syncLocked = true;
+			if(locksSinceStart++ > 0 || barMoved % params->barLength != 0) // A re-lock (the grid may have slipped against the slaves while it was lost) or a new bar.
+			{
+				songPositionPending = true;
+			}
+			barMoved = 0;
+			rt_printf("SYNC LOCKED (phase error %f ms)\n", filteredPhaseError);
 		}
-		
-    	else if (proximityToExpected > (syncThreshold + 0.1)) // We are close enough to the beat so no need for Sync.
-    	{
-    		syncDelta = 0; // reset the sync amount to 0 so that it does not affect the tempo adjustment.
-    		
-    		// Raise the threshold.
-    		syncThreshold = syncThreshold + (0.3 * (proximityToExpected - syncThreshold - 0.1));
-    		// syncStdDev *= 0.9; // Narrowing the gaussian window (GUESSWORK VARIABLE AT THIS STAGE)
-   	
-    	}
-    	
-    	else if (proximityToExpected < syncThreshold)
-    	{
-    		// lower the threshold (closer to the threshold has a more dramatic effect)
-    		syncThreshold = syncThreshold * (1 - gaussianSync(discrepency));
-    		// syncStdDev *= 1.3; // Widening the gaussian window (GUESSWORK VARIABLE AT THIS STAGE)
-    	}
-	} 
-	
-	for(int k = 0; k < MAX_ONSETS; k ++)
+	}
+	else if(filteredPhaseError > 2 * syncThreshold)
 	{
-		 discrepencySum += discrepencies[k];
+		resetSync();
+		rt_printf("SYNC LOST (phase error %f ms)\n", filteredPhaseError);
+	}
+}
+
+// Back to acquiring.
+void resetSync()
+{
+	syncLocked = false;
+	lockCount = 0;
+	missCount = 0;
+	syncDelta = 0;
+}
+
+// Adds a captured onset at this position of the bar to the downbeat histogram and moves the bar when another
+// position fits the weight table clearly better as the downbeat. Returns how many eighth notes the bar moved by.
+// O(barLength^2), so at most 256 multiply adds per onset.
+int updateDownbeat(int position)
+{
+	int length = params->barLength;
+	for(int i = 0; i < length; i++)
+	{
+		downbeatHistogram[i] *= DOWNBEAT_DECAY;
+	}
+	downbeatHistogram[position] += 1;
+	if(++downbeatOnsets < DOWNBEAT_MIN_ONSETS || beatPos < 0)
+	{
+		return 0;
 	}
 	
-	discrepencyMean = discrepencySum / MAX_ONSETS;
-	
-	for(int k = 0; k < MAX_ONSETS; k ++)
+	// Score of each candidate downbeat: how well the onsets line up with the weights if the bar started there.
+	float bestScore = 0;
+	float currentScore = 0;
+	int best = 0;
+	for(int r = 0; r < length; r++)
+	{
+		float score = 0;
+		for(int i = 0; i < length; i++)
+		{
+			score += downbeatHistogram[(i + r) % length] * params->syncWeights[i];
+		}
+		if(r == 0)
+		{
+			currentScore = score;
+		}
+		if(score > bestScore)
+		{
+			bestScore = score;
+			best = r;
+		}
+	}
+	if(best == 0 || bestScore < currentScore * DOWNBEAT_MARGIN)
 	{
-		 discrepencyCumDifs += powf((discrepencies[k] - discrepencyMean), 2);
+		return 0;
 	}
 	
-	if (tapCount > MAX_ONSETS) // only update when we have a large enough dataset.
+	// Position "best" is the new downbeat, so everything moves back by that much.
+	float rotated[MAX_BAR_LENGTH];
+	for(int i = 0; i < length; i++)
+	{
+		rotated[i] = downbeatHistogram[(i + best) % length];
+	}
+	memcpy(downbeatHistogram, rotated, sizeof(float) * length);
+	beatPos = (beatPos + length - best) % length;
+	if(syncLocked)
+	{
+		songPositionPending = true;
+	}
+	else
 	{
-	syncStdDev = discrepencyCumDifs/discrepencyMean;
+		barMoved += best;
 	}
+	rt_printf("DOWNBEAT MOVED by %d eighth notes\n", best);
+	return best;
+}
+
+void resetDownbeat()
+{
+	memset(downbeatHistogram, 0, sizeof(downbeatHistogram));
+	downbeatOnsets = 0;
+}
+
+// Tells the slaves where we are in the song (sixteenth notes since the Start). Song Position Pointer is only
+// meant to be sent while stopped, so it goes out as Stop, SPP, Continue just after the clock byte at pulseSample
+// when the next pulse starts an eighth note (the slaves carry on from there), if it's through before that pulse.
+// Returns true if it was sent.
+bool sendSongPosition(uint64_t pulseSample)
+{
+	if(!songPositionPending || !enoughTrackTaps || frames % 12 != 0 || pulseTimer.due - pulseSample < (uint64_t)songPositionGap)
+	{
+		return false;
+	}
+	int position = beatPos + 1; // The next eighth note.
+	int bar = barCount;
+	if(position >= params->barLength)
+	{
+		position = 0;
+		bar ++;
+	}
+	int sixteenths = ((bar * params->barLength + position) * 2) & 0x3FFF;
+	midi_byte_t bytes[5] = {252, 242, (midi_byte_t)(sixteenths & 0x7F), (midi_byte_t)((sixteenths >> 7) & 0x7F), 251};
+	writeMidi(pulseSample, bytes, 5);
+	songPositionPending = false;
+	return true;
 }
 
 void calculateStandardNoteDivisions(float newBpm)
@@ -624,35 +1199,698 @@ void calculateStandardNoteDivisions(float newBpm)
 	halfNote = quarterNote * 2;
 	wholeNote = quarterNote * 4;
 	
-	timeOutsamples = ((digitalSampleRate / 1000) * quarterNote) / 4;
+	timeOutsamples = quarterNote / 4 * oneMs; // On the audio sample timer wheel.
 }
 
-float gaussianSync (float discrepency)
+float gaussianTempo (float error)
 {
-	float exponent = (std::pow((discrepency), 2) / (2 * syncStdDev)) * -1; // Don't need to square standardDev as the variance (squared StdDev) is calculated from dataset.
+
+	float exponent = (std::pow((error), 2) / (2 *tempoStdDev)) * -1;
+	if(!(exponent > GAUSSIAN_MIN_EXPONENT)) // The far tail (or a NaN error) counts as no match at all.
+	{
+		return 0.f;
+	}
 	return std::exp(exponent);
 }
 
-float gaussianTempo (float error)
+// Footswitch mode state machine, run once per block before the onset loop.
+// The footswitch level is sampled at the end of the block and has to hold for debounceSamples before the mode
+// changes, so bounces never get as far as enterMode(). The very first reading is taken straight away.
+void updateMode(BelaContext *context)
 {
+	int level = digitalRead(context, context->digitalFrames - 1, P8_08) ? TRACK_MODE : TAP_MODE;
+	
+	if(level != switchLevel)
+	{
+		uint8_t pin = level == TRACK_MODE;
+		journalEvent(context->audioFramesElapsed, JOURNAL_SWITCH, &pin, 1);
+		switchLevel = level;
+		switchStableSamples = 0;
+	}
+	else if(switchStableSamples < debounceSamples)
+	{
+		switchStableSamples += context->digitalFrames;
+	}
+	
+	if(pulseMode == NO_MODE || (level != pulseMode && switchStableSamples >= debounceSamples))
+	{
+		enterMode(context, level);
+	}
+}
 
-	float exponent = (std::pow((error), 2) / (2 *tempoStdDev)) * -1;
-	return std::exp(exponent);
+// Mode transitions. Every change of mode goes through here, with these resets:
+// entering TAP_MODE starts the tap count again (the coarse tempo is tapped from scratch) and turns the TRACK_MODE LED off;
+// entering TRACK_MODE keeps the onsets collected so far and turns the TAP_MODE LED off.
+void enterMode(BelaContext *context, int newMode)
+{
+	if(newMode == TAP_MODE)
+	{
+		coarseTaps = 0;
+		tapCount = 0;
+		resetTapTempo(tapTempo);
+		enoughCoarseTaps = false;
+		setLed(context, 0, TRACK_MODE, GPIO_LOW);
+	}
+	else
+	{
+		setLed(context, 0, TAP_MODE, GPIO_LOW);
+	}
+	cancelTimer(timerWheel, ledTimer);
+	confidence = 0; // Only TRACK_MODE earns any.
+	pulseMode = newMode;
+	uint8_t mode = newMode;
+	journalEvent(context->audioFramesElapsed, JOURNAL_MODE, &mode, 1);
+	rt_printf("MODE = %s\n", newMode == TAP_MODE ? "TAP" : "TRACK");
+}
+
+// Sets the clock for the current bpm and starts the glide towards it from the current pulse spacing.
+void setPulseInterval()
+{
+	pulseTarget = ((60000 / bpm) / 24) * (audioSampleRate / 1000.0); // equation to determine the miliseconds needed per pulse.
+										// ...Because Midi clock needs 24 pulses per quaternote (PPQ)
+										// then I multiply by the samples per ms to give the result in samples.
+	sampleInterval = pulseTarget;
+	
+	if(params->glidePulses > 0)
+	{
+		glideStep = (pulseTarget - pulseSpacing) / params->glidePulses;
+		glideRemaining = params->glidePulses;
+	}
+	else
+	{
+		pulseSpacing = pulseTarget;
+		glideRemaining = 0;
+	}
+}
+
+// Writes an LED edge, if the LED isn't already at that level.
+void setLed(BelaContext *context, int frame, int mode, int state)
+{
+	if(ledStates[mode] != state)
+	{
+		digitalWrite(context, frame, ledPins[mode], state);
+		ledStates[mode] = state;
+	}
+}
+
+// Until tempo tracking has started the LED is steadily on just to show signs of life. After that it flashes
+// for timeOutsamples on each quarter note, the on edge from clockPulse() and the off edge from ledTimer.
+void updateLeds(BelaContext *context)
+{
+	int mode = pulseMode;
+	bool tracking = (mode == TRACK_MODE) ? enoughTrackTaps : enoughCoarseTaps;
+	
+	if(!tracking)
+	{
+		setLed(context, 0, mode, GPIO_HIGH);
+		cancelTimer(timerWheel, ledTimer);
+	}
+}
+
+// Moves pulseOrigin up to the start of this block, so the onset handlers can shift pulseCountdown.
+void catchUpPulse()
+{
+	pulseCountdown -= (int64_t)(timerWheel.blockStart - pulseOrigin); // Signed, so it also works when called from outside render().
+	pulseOrigin = timerWheel.blockStart;
+}
+
+// Puts the next clock pulse on the frame pulseCountdown runs out on.
+void schedulePulse()
+{
+	float due = ceilf(pulseCountdown) - 1;
+	scheduleTimer(timerWheel, pulseTimer, pulseOrigin + (due > 0 ? (uint64_t)due : 0));
+}
+
+// A clock pulse (a 24th of a quarter note), from pulseTimer.
+void clockPulse(BelaContext *context, unsigned int frame)
+{
+	uint64_t pulseSample = context->audioFramesElapsed + frame;
+	pulseCountdown -= pulseSample + 1 - pulseOrigin;
+	pulseOrigin = pulseSample + 1;
+	if(glideRemaining > 0)
+	{
+		pulseSpacing += glideStep;
+		glideRemaining --;
+	}
+	float slew = PLL_SLEW * pulseSpacing;
+	float phaseStep = fminf(fmaxf(phasePending, -slew), slew); // This pulse's share of the phase correction.
+	phasePending -= phaseStep;
+	pulseCountdown += pulseSpacing + phaseStep; // Carrying the fraction of a sample over to the next pulse.
+	
+	if(frames % 12 == 0) // Every EighthNote (12 pulses), so the grid is exactly what the slaves hear.
+	{
+		mostRecentMidiClickTime = (pulseSample / context->audioSampleRate) * 1000; // Getting the time NOW.
+		
+		if(enoughTrackTaps)
+		{
+			beatPos ++;
+			if(beatPos >= params->barLength)
+			{
+				beatPos = 0;
+				barCount ++;
+			}
+		}
+	}
+	mostRecentMidiClickTime += phaseStep / oneMs; // The grid moves as the pulses do.
+	
+	midi_byte_t clockPulse = 248; // Midi byte is set to decimal 248 (Midid devices recognise this as clock pulse)
+	writeMidi(pulseSample, &clockPulse, 1); // Send the pulse to the device.
+	
+	if(latencyMode && latencyPending)
+	{
+		float latency = 0;
+		if(pulseSample > latencyOnsetSample)
+		{
+			latency = (pulseSample - latencyOnsetSample) / oneMs;
+		}
+		int bucket = latency;
+		if(bucket >= LATENCY_BUCKETS)
+		{
+			bucket = LATENCY_BUCKETS - 1;
+		}
+		latencyHistogram[bucket] ++;
+		latencyCount ++;
+		latencySum += latency;
+		if(latency > latencyMax)
+		{
+			latencyMax = latency;
+		}
+		latencyPending = false;
+	}
+	
+	frames ++; // increment the number of frames
+	if (frames == 24) // when we've reached a whole quaternote
+	{
+		frames = 0;
+		int mode = pulseMode;
+		if((mode == TRACK_MODE) ? enoughTrackTaps : enoughCoarseTaps) // LED on for the beat, off timeOutsamples later.
+		{
+			setLed(context, (frame * context->digitalFrames) / context->audioFrames, mode, GPIO_HIGH);
+			scheduleTimer(timerWheel, ledTimer, pulseSample + timeOutsamples); // The digital and audio rates are the same.
+		}
+	}
+	schedulePulse();
+	if(!sendSongPosition(pulseSample))
+	{
+		sendConfidence(pulseSample);
+	}
+}
+
+// Been a long time since the last onset (resetTimer), so start collecting onsets and comparing again.
+void resetTracking(BelaContext *context, unsigned int frame)
+{
+	tapCount = 0;
+	resetTapTempo(tapTempo);
+	beatPos = -1;
+	enoughTrackTaps = false;
+	enoughCoarseTaps = false;
+	enoughTaps = false;
+	journalEvent(context->audioFramesElapsed + frame, JOURNAL_RESET);
+	cancelTimer(timerWheel, ledTimer);
+	resetSync();
+	resetDownbeat();
+	setLed(context, (frame * context->digitalFrames) / context->audioFrames, pulseMode, GPIO_HIGH); //Switching LED back on to indicate no Tempo Tracking.
+	
+	rt_printf("TOO LONG SINCE LAST TAP, RESET\n");
+	confidence = 0;
+}
+
+// Smooths the confidence towards this onset's score (after tempoAdjust()).
+void updateConfidence()
+{
+	float score = fminf(fmaxf(onsetAccuracy, 0.f), 1.f);
+	if(!syncLocked)
+	{
+		score *= 0.5;
+	}
+	confidence += CONFIDENCE_SMOOTHING * (score - confidence);
+}
+
+// From confidenceTimer: queues the confidence for sendConfidence() if its CC value has changed.
+void sampleConfidence()
+{
+	int value = lroundf(confidence * 127);
+	if(value != confidenceSent)
+	{
+		confidenceValue = value;
+		confidencePending = true;
+	}
+	else
+	{
+		confidencePending = false; // Went back to what was last sent.
+	}
+}
+
+// Sends the queued confidence CC just after the clock byte at pulseSample, if it's through before the next one.
+void sendConfidence(uint64_t pulseSample)
+{
+	if(!confidencePending || params->confidenceCC < 0 || pulseTimer.due - pulseSample < (uint64_t)confidenceGap)
+	{
+		return;
+	}
+	midi_byte_t bytes[3] = {(midi_byte_t)(0xB0 | params->confidenceChannel), (midi_byte_t)params->confidenceCC, (midi_byte_t)confidenceValue};
+	writeMidi(pulseSample, bytes, 3);
+	confidenceSent = confidenceValue;
+	confidencePending = false;
+}
+
+// Copies the tracker state into the telemetry sample (render thread).
+// The sequence counter is odd while writing so the aux task can tell if it read a torn sample.
+void publishTelemetry(BelaContext *context)
+{
+	telemetrySeq.fetch_add(1, std::memory_order_acq_rel);
+	telemetrySample.seconds = context->audioFramesElapsed / context->audioSampleRate;
+	telemetrySample.bpm = bpm;
+	telemetrySample.tempoThreshold = tempoThreshold;
+	telemetrySample.tempoStdDev = tempoStdDev;
+	telemetrySample.syncThreshold = syncThreshold;
+	telemetrySample.syncDelta = syncDelta;
+	telemetrySample.beatPos = beatPos;
+	telemetrySample.lastAccuracy = onsetAccuracy;
+	telemetrySample.meanAccuracy = telemetryOnsets > 0 ? telemetryAccuracySum / telemetryOnsets : 0.f;
+	telemetrySample.onsets = telemetryOnsets;
+	telemetrySeq.fetch_add(1, std::memory_order_release);
+	
+	telemetryOnsets = 0;
+	telemetryAccuracySum = 0;
+}
+
+// Aux task: takes a consistent copy of the latest sample and sends it as a single OSC message.
+void telemetryCallback()
+{
+	TelemetrySample sample;
+	unsigned int before;
+	unsigned int after;
+	do
+	{
+		before = telemetrySeq.load(std::memory_order_acquire);
+		sample = telemetrySample;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = telemetrySeq.load(std::memory_order_relaxed);
+	} while((before & 1) || before != after); // Render thread was mid-write, try again.
+	
+	telemetryClient.queueMessage(telemetryClient.newMessage.to("/pulse/telemetry")
+		.add(sample.seconds).add(sample.bpm)
+		.add(sample.tempoThreshold).add(sample.tempoStdDev)
+		.add(sample.syncThreshold).add(sample.syncDelta)
+		.add(sample.beatPos)
+		.add(sample.lastAccuracy).add(sample.meanAccuracy).add(sample.onsets).end());
+}
+
+// Adds a record to the journal, if there is one (render thread, or setup() and cleanup()).
+void journalEvent(uint64_t sample, int type, const void* payload, uint32_t size)
+{
+	if(journalFile)
+	{
+		journalRecord(journal, sample, type, payload, size);
+	}
+}
+
+// Sends Midi bytes, and journals them with the sample they were meant for.
+void writeMidi(uint64_t sample, midi_byte_t* bytes, unsigned int length)
+{
+	midi.writeOutput(bytes, length);
+	journalEvent(sample, JOURNAL_MIDI, bytes, length);
+}
+
+// Aux task: writes the journal out.
+void journalCallback()
+{
+	drainJournal(journal, journalFile);
+}
+
+// True if every float in the parameter set is finite.
+bool paramsFinite(const TrackerParams& p)
+{
+	float values[] = {p.tempoThreshold, p.syncThreshold, p.alpha, p.beta, p.tempoStdDev, p.syncStdDev, p.minBpm, p.maxBpm,
+		p.onsetThreshold, p.releaseThreshold, p.classifyWindow, p.kickPeak, p.maxRise, p.minDecay, p.bleedWindow, p.bleedRatio,
+		p.audioCutoff, p.audioGain, p.audioRelease};
+	for(unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+	{
+		if(!std::isfinite(values[i]))
+		{
+			return false;
+		}
+	}
+	for(int i = 0; i < 16; i++)
+	{
+		if(!std::isfinite(p.tempoWeights[i]))
+		{
+			return false;
+		}
+	}
+	for(int i = 0; i < MAX_BAR_LENGTH; i++)
+	{
+		if(!std::isfinite(p.syncWeights[i]))
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
-void discrepencyCalculation(float timeNow)
+// Opens the snapshot file and, if it holds a usable state, takes it up (setup, once the context has passed its
+// checks, so a refused start never sends the slaves a Start).
+void restoreSnapshot()
 {
-	float timeElapsedSinceLastMidiClick = timeNow - mostRecentMidiClickTime;
+	if(!snapshotPath || !openSnapshot(snapshotFile, snapshotPath))
+	{
+		return;
+	}
+	TrackerState state;
+	if(!readSnapshot(snapshotFile, SNAPSHOT_VERSION, &state, sizeof(state)))
+	{
+		return;
+	}
+	const TrackerParams& p = state.params;
+	if(!paramsFinite(p) || !(p.minBpm > 0 && p.minBpm < p.maxBpm && state.bpm >= p.minBpm && state.bpm <= p.maxBpm)
+		|| p.barLength <= 0 || p.barLength > MAX_BAR_LENGTH || p.audioChannel < 0 || p.audioChannel >= (int)audioInputs
+		|| !std::isfinite(state.tempoThreshold) || !std::isfinite(state.syncThreshold)
+		|| !(state.tempoStdDev >= TEMPO_STD_DEV_MIN && state.tempoStdDev <= TEMPO_STD_DEV_MAX) || !(state.syncStdDev > 0))
+	{
+		rt_printf("SNAPSHOT IGNORED (out of range)\n");
+		return;
+	}
 	
-	if (timeElapsedSinceLastMidiClick > (eightNote / 2))
+	for(int s = 0; s < 3; s ++)
 	{
-		closestMidiClickTime = mostRecentMidiClickTime + eightNote;
-		beatOffset = 1;
+		paramSlots[s] = p;
+	}
+	stagedParams = p;
+	applyParams();
+	tempoThreshold = state.tempoThreshold; // The adapted values, not the parameters' starting points.
+	syncThreshold = state.syncThreshold;
+	tempoStdDev = state.tempoStdDev;
+	syncStdDev = state.syncStdDev;
+	bpm = state.bpm;
+	calculateStandardNoteDivisions(bpm);
+	
+	double age = time(0) - state.savedAt;
+	bool resume = snapshotResume >= 0 ? snapshotResume : state.running && age >= 0 && age < SNAPSHOT_RESUME_S;
+	if(journalFile)
+	{
+		unsigned char record[8 + sizeof(state)] = {};
+		uint32_t version = SNAPSHOT_VERSION;
+		memcpy(record, &version, 4);
+		record[4] = resume;
+		memcpy(record + 8, &state, sizeof(state));
+		journalEvent(0, JOURNAL_RESTORED, record, sizeof(record));
+	}
+	if(resume)
+	{
+		enoughTaps = true;
+		midi_byte_t startByte = 250;
+		writeMidi(0, &startByte, 1);
+		rt_printf("SNAPSHOT RESTORED, RESUMING AT %f BPM\n", bpm);
 	}
 	else
 	{
-		closestMidiClickTime = mostRecentMidiClickTime;	
-		beatOffset = 0;
+		rt_printf("SNAPSHOT RESTORED, %f BPM\n", bpm);
+	}
+}
+
+// Copies the tracker state into snapshotState (render thread).
+void publishSnapshot()
+{
+	snapshotSeq.fetch_add(1, std::memory_order_acq_rel);
+	snapshotState.running = enoughTaps;
+	snapshotState.bpm = bpm;
+	snapshotState.tempoThreshold = tempoThreshold;
+	snapshotState.syncThreshold = syncThreshold;
+	snapshotState.tempoStdDev = tempoStdDev;
+	snapshotState.syncStdDev = syncStdDev;
+	snapshotState.params = *params;
+	snapshotSeq.fetch_add(1, std::memory_order_release);
+}
+
+// Aux task: takes a consistent copy of snapshotState and writes it, unless nothing has changed since the last
+// one and the clock isn't running (a running clock is written every time, to keep its age current).
+void snapshotCallback()
+{
+	static TrackerState written;
+	static bool haveWritten = false;
+	TrackerState state;
+	unsigned int before;
+	unsigned int after;
+	do
+	{
+		before = snapshotSeq.load(std::memory_order_acquire);
+		memcpy(&state, &snapshotState, sizeof(state));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = snapshotSeq.load(std::memory_order_relaxed);
+	} while((before & 1) || before != after); // Render thread was mid-write, try again.
+	
+	state.savedAt = written.savedAt;
+	if(haveWritten && !state.running && !memcmp(&state, &written, sizeof(state)))
+	{
+		return;
+	}
+	state.savedAt = time(0);
+	if(writeSnapshot(snapshotFile, SNAPSHOT_VERSION, &state, sizeof(state)))
+	{
+		memcpy(&written, &state, sizeof(state));
+		haveWritten = true;
+	}
+}
+
+// Swaps in the most recently published parameter set (render thread, start of each block).
+void takeNewParams()
+{
+	if(paramsMiddle.load(std::memory_order_relaxed) & PARAMS_FRESH)
+	{
+		paramsFront = paramsMiddle.exchange(paramsFront, std::memory_order_acq_rel) & 3;
+		params = &paramSlots[paramsFront];
+		applyParams();
+		journalEvent(timerWheel.blockStart, JOURNAL_PARAMS, params, sizeof(TrackerParams));
+		rt_printf("NEW PARAMETERS\n");
+	}
+}
+
+// Restarting the adaptive values from the starting points in the current parameter set.
+void applyParams()
+{
+	tempoThreshold = params->tempoThreshold;
+	syncThreshold = params->syncThreshold;
+	tempoStdDev = params->tempoStdDev;
+	syncStdDev = params->syncStdDev;
+	setClassifierParams(classifierParams, *params, analogSampleRate);
+	setAudioOnsetParams(audioDetectorParams, audioSampleRate, audioFramesPerFrame, params->audioCutoff, params->audioGain, params->audioRelease);
+	if(beatPos >= params->barLength) // Shorter bar.
+	{
+		beatPos = 0;
+	}
+	resetDownbeat(); // The weights may have changed, so start looking for the downbeat again.
+}
+
+// Aux task: reads the waiting OSC messages and edits the staged parameter set.
+// "/pulse/params/commit" publishes it, "/pulse/params/defaults" goes back to the defaults.
+// "/pulse/params/meter 7 8" loads the bar length and sync weights of one of the meterPresets.
+// Weights are sent as index and value, e.g. "/pulse/params/tempoWeight 3 0.8".
+// "/pulse/params/onsetSource 1" takes the onsets from the audio input set with "/pulse/params/audioInput 0 150 4"
+// (channel, cutoff Hz, gain), 0 goes back to the piezo.
+// "/pulse/params/confidenceCC 0 16" sends the confidence as CC 16 on Midi channel 1, a controller of -1 turns it off.
+// A message with a value out of range, NaN or infinite is ignored, so the staged set only ever holds finite values.
+void oscCallback()
+{
+	bool publish = false;
+	
+	while(oscServer.messageWaiting())
+	{
+		oscpkt::Message msg = oscServer.popMessage();
+		int index = 0;
+		int length = 0;
+		float value = 0;
+		float value2 = 0;
+		
+		if(msg.match("/pulse/params/tempoThreshold").popFloat(value).isOkNoMoreArgs() && std::isfinite(value))
+			stagedParams.tempoThreshold = value;
+		else if(msg.match("/pulse/params/syncThreshold").popFloat(value).isOkNoMoreArgs() && std::isfinite(value))
+			stagedParams.syncThreshold = value;
+		else if(msg.match("/pulse/params/alpha").popFloat(value).isOkNoMoreArgs() && std::isfinite(value))
+			stagedParams.alpha = value;
+		else if(msg.match("/pulse/params/beta").popFloat(value).isOkNoMoreArgs() && std::isfinite(value))
+			stagedParams.beta = value;
+		else if(msg.match("/pulse/params/tempoStdDev").popFloat(value).isOkNoMoreArgs()
+			&& value > 0 && std::isfinite(value))
+			stagedParams.tempoStdDev = value;
+		else if(msg.match("/pulse/params/syncStdDev").popFloat(value).isOkNoMoreArgs()
+			&& value > 0 && std::isfinite(value))
+			stagedParams.syncStdDev = value;
+		else if(msg.match("/pulse/params/tempoWeight").popInt32(index).popFloat(value).isOkNoMoreArgs()
+			&& index >= 0 && index < 16 && std::isfinite(value))
+			stagedParams.tempoWeights[index] = value;
+		else if(msg.match("/pulse/params/syncWeight").popInt32(index).popFloat(value).isOkNoMoreArgs()
+			&& index >= 0 && index < MAX_BAR_LENGTH && std::isfinite(value))
+			stagedParams.syncWeights[index] = value;
+		else if(msg.match("/pulse/params/barLength").popInt32(index).isOkNoMoreArgs() && index > 0 && index <= MAX_BAR_LENGTH)
+			stagedParams.barLength = index;
+		else if(msg.match("/pulse/params/meter").popInt32(index).popInt32(length).isOkNoMoreArgs())
+		{
+			int m = 0;
+			while(m < numMeterPresets && (meterPresets[m].numerator != index || meterPresets[m].denominator != length))
+			{
+				m++;
+			}
+			if(m < numMeterPresets)
+			{
+				stagedParams.barLength = meterPresets[m].barLength;
+				memcpy(stagedParams.syncWeights, meterPresets[m].syncWeights, sizeof(stagedParams.syncWeights));
+			}
+			else
+			{
+				rt_printf("No preset for %d/%d, use /pulse/params/barLength and /pulse/params/syncWeight\n", index, length);
+			}
+		}
+		else if(msg.match("/pulse/params/bpmRange").popFloat(value).popFloat(value2).isOkNoMoreArgs()
+			&& value > 0 && value < value2 && std::isfinite(value) && std::isfinite(value2))
+		{
+			stagedParams.minBpm = value;
+			stagedParams.maxBpm = value2;
+		}
+		else if(msg.match("/pulse/params/onsetThresholds").popFloat(value).popFloat(value2).isOkNoMoreArgs()
+			&& value2 < value && std::isfinite(value) && std::isfinite(value2))
+		{
+			stagedParams.onsetThreshold = value;
+			stagedParams.releaseThreshold = value2;
+		}
+		else if(msg.match("/pulse/params/classifyWindow").popFloat(value).isOkNoMoreArgs()
+			&& value >= 0 && value < 50 && std::isfinite(value))
+			stagedParams.classifyWindow = value;
+		else if(msg.match("/pulse/params/kickPeak").popFloat(value).isOkNoMoreArgs() && std::isfinite(value))
+			stagedParams.kickPeak = value;
+		else if(msg.match("/pulse/params/swell").popFloat(value).popFloat(value2).isOkNoMoreArgs()
+			&& value >= 0 && std::isfinite(value) && std::isfinite(value2))
+		{
+			stagedParams.maxRise = value;
+			stagedParams.minDecay = value2;
+		}
+		else if(msg.match("/pulse/params/bleed").popFloat(value).popFloat(value2).isOkNoMoreArgs()
+			&& value >= 0 && std::isfinite(value) && std::isfinite(value2))
+		{
+			stagedParams.bleedWindow = value;
+			stagedParams.bleedRatio = value2;
+		}
+		else if(msg.match("/pulse/params/onsetSource").popInt32(index).isOkNoMoreArgs() && (index == ONSET_SOURCE_PIEZO || index == ONSET_SOURCE_AUDIO))
+			stagedParams.onsetSource = index;
+		else if(msg.match("/pulse/params/audioInput").popInt32(index).popFloat(value).popFloat(value2).isOkNoMoreArgs()
+			&& index >= 0 && index < (int)audioInputs && value > 0 && value < audioSampleRate / 2 && value2 > 0 && std::isfinite(value) && std::isfinite(value2))
+		{
+			stagedParams.audioChannel = index;
+			stagedParams.audioCutoff = value;
+			stagedParams.audioGain = value2;
+		}
+		else if(msg.match("/pulse/params/audioRelease").popFloat(value).isOkNoMoreArgs()
+			&& value >= 0 && std::isfinite(value))
+			stagedParams.audioRelease = value;
+		else if(msg.match("/pulse/params/confidenceCC").popInt32(index).popInt32(length).isOkNoMoreArgs()
+			&& index >= 0 && index < 16 && length >= -1 && length < 120)
+		{
+			stagedParams.confidenceChannel = index;
+			stagedParams.confidenceCC = length;
+		}
+		else if(msg.match("/pulse/params/glidePulses").popInt32(index).isOkNoMoreArgs() && index >= 0)
+			stagedParams.glidePulses = index;
+		else if(msg.match("/pulse/params/defaults").isOkNoMoreArgs())
+		{
+			stagedParams = defaultParams;
+			publish = true;
+		}
+		else if(msg.match("/pulse/params/commit").isOkNoMoreArgs())
+		{
+			publish = true;
+		}
+		else if(msg.match("/pulse/profile/dump").isOkNoMoreArgs())
+		{
+			printStageHistogram(onsetProfile);
+			printStageHistogram(tempoProfile);
+			printStageHistogram(syncProfile);
+			printStageHistogram(classifyProfile);
+			printf("onsets: %u kick, %u ghost, %u bleed\n", onsetCounts[ONSET_KICK], onsetCounts[ONSET_GHOST], onsetCounts[ONSET_BLEED]);
+			printStageHistogram(audioProfile);
+			printStageHistogram(timerProfile);
+			printStageHistogram(renderProfile);
+		}
+		else if(msg.match("/pulse/profile/reset").isOkNoMoreArgs())
+		{
+			profileResetRequest = true;
+		}
+		else if(msg.match("/pulse/latency/start").isOkNoMoreArgs())
+		{
+			latencyRequest = 1;
+		}
+		else if(msg.match("/pulse/latency/stop").isOkNoMoreArgs())
+		{
+			latencyRequest = 2;
+		}
+		else
+		{
+			rt_printf("Unknown OSC message %s\n", msg.addressPattern().c_str());
+		}
+	}
+	
+	if(publish)
+	{
+		publishParams(&stagedParams, sizeof(stagedParams));
+	}
+}
+
+// Hands a parameter set to the render thread (aux task, or Tools/Journal putting a journaled set back).
+// False if it isn't the size of a TrackerParams.
+bool publishParams(const void* data, size_t size)
+{
+	if(size != sizeof(TrackerParams))
+	{
+		return false;
+	}
+	memcpy(&paramSlots[paramsBack], data, size);
+	paramsBack = paramsMiddle.exchange(paramsBack | PARAMS_FRESH, std::memory_order_acq_rel) & 3;
+	return true;
+}
+// Prints the latency distribution of the last measurement session (aux task, or cleanup()).
+// The render thread has stopped writing to the histogram before this is scheduled, and doesn't start a new
+// session until it's done.
+void latencyReport()
+{
+	printLatencyReport();
+	latencyReporting.store(false, std::memory_order_release);
+}
+
+void printLatencyReport()
+{
+	printf("ONSET TO CLOCK LATENCY: %u corrections, %u onsets without a correction\n", latencyCount, latencyUncorrected);
+	if(latencyCount == 0)
+	{
+		return;
+	}
+	
+	// Percentiles from the 1 ms buckets (upper edge of the bucket they fall in).
+	float percentiles[3] = {0.5, 0.95, 0.99};
+	int results[3] = {LATENCY_BUCKETS, LATENCY_BUCKETS, LATENCY_BUCKETS};
+	unsigned int cumulative = 0;
+	for(int b = 0; b < LATENCY_BUCKETS; b++)
+	{
+		cumulative += latencyHistogram[b];
+		for(int p = 0; p < 3; p++)
+		{
+			if(results[p] == LATENCY_BUCKETS && cumulative >= percentiles[p] * latencyCount)
+			{
+				results[p] = b + 1;
+			}
+		}
+	}
+	printf("mean = %.2f ms	max = %.2f ms	p50 < %d ms	p95 < %d ms	p99 < %d ms\n",
+		latencySum / latencyCount, latencyMax, results[0], results[1], results[2]);
+	
+	for(int b = 0; b < LATENCY_BUCKETS; b++)
+	{
+		if(latencyHistogram[b] && b == LATENCY_BUCKETS - 1)
+		{
+			printf("	>= %d ms	%u\n", b, latencyHistogram[b]);
+		}
+		else if(latencyHistogram[b])
+		{
+			printf("	%2d - %2d ms	%u\n", b, b + 1, latencyHistogram[b]);
+		}
 	}
 }
 // End Project - 